@@ -0,0 +1,183 @@
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "thread_basics/buffered_channel.h"
+#include "thread_basics/unbuffered_channel.h"
+
+// Usage: channel_bench [--producers <n>] [--consumers <n>] [--messages <per producer>]
+//                      [--capacity <n>] [--batch <n>]
+//
+// Producers send --messages integers each, consumers receive until the channel is closed.
+// Reports the throughput of BufferedChannel and of a reference channel on a mutex, a deque
+// and two condition variables. Channels with SendMany/RecvMany are also run with batches of
+// --batch messages. UnbufferedChannel ignores --capacity.
+
+namespace {
+struct Options {
+    size_t producers = 4;
+    size_t consumers = 4;
+    size_t messages = 1'000'000;
+    size_t capacity = 1024;
+    size_t batch = 64;
+};
+
+template <class T>
+class MutexChannel {
+public:
+    explicit MutexChannel(size_t size) : size_(size) {
+    }
+
+    void Send(const T& value) {
+        {
+            std::unique_lock lock(mutex_);
+            send_.wait(lock, [this] { return closed_ || buffer_.size() < size_; });
+            if (closed_) {
+                throw std::runtime_error("chan is closed");
+            }
+            buffer_.push_back(value);
+        }
+        recv_.notify_one();
+    }
+
+    std::optional<T> Recv() {
+        std::optional<T> ret;
+        {
+            std::unique_lock lock(mutex_);
+            recv_.wait(lock, [this] { return closed_ || !buffer_.empty(); });
+            if (buffer_.empty()) {
+                return std::nullopt;
+            }
+            ret.emplace(std::move(buffer_.front()));
+            buffer_.pop_front();
+        }
+        send_.notify_one();
+        return ret;
+    }
+
+    void Close() {
+        {
+            std::lock_guard lock(mutex_);
+            closed_ = true;
+        }
+        send_.notify_all();
+        recv_.notify_all();
+    }
+
+private:
+    size_t size_;
+    std::mutex mutex_;
+    std::condition_variable send_;
+    std::condition_variable recv_;
+    std::deque<T> buffer_;
+    bool closed_ = false;
+};
+
+template <class Channel>
+void Run(const std::string& name, const Options& options, size_t batch = 1) {
+    auto channel = [&] {
+        if constexpr (std::is_constructible_v<Channel, size_t>) {
+            return Channel(options.capacity);
+        } else {
+            return Channel();
+        }
+    }();
+    std::vector<std::thread> producers;
+    std::vector<std::thread> consumers;
+    std::vector<uint64_t> sums(options.consumers);
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < options.consumers; ++i) {
+        consumers.emplace_back([&, i] {
+            uint64_t sum = 0;
+            if (batch == 1) {
+                while (auto value = channel.Recv()) {
+                    sum += *value;
+                }
+            } else if constexpr (requires { channel.RecvMany(sums.begin(), 1); }) {
+                std::vector<uint64_t> values(batch);
+                while (auto count = channel.RecvMany(values.begin(), batch)) {
+                    for (size_t j = 0; j < count; ++j) {
+                        sum += values[j];
+                    }
+                }
+            }
+            sums[i] = sum;
+        });
+    }
+    for (size_t i = 0; i < options.producers; ++i) {
+        producers.emplace_back([&] {
+            if (batch == 1) {
+                for (uint64_t value = 0; value < options.messages; ++value) {
+                    channel.Send(value);
+                }
+            } else if constexpr (requires { channel.SendMany(std::span<uint64_t>{}); }) {
+                std::vector<uint64_t> values;
+                for (uint64_t value = 0; value < options.messages; ++value) {
+                    values.push_back(value);
+                    if (values.size() == batch || value + 1 == options.messages) {
+                        channel.SendMany(values);
+                        values.clear();
+                    }
+                }
+            }
+        });
+    }
+    for (auto& thread : producers) {
+        thread.join();
+    }
+    channel.Close();
+    for (auto& thread : consumers) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    uint64_t sum = 0;
+    for (auto value : sums) {
+        sum += value;
+    }
+    uint64_t expected = options.producers * (options.messages * (options.messages - 1) / 2);
+    std::cout << std::setw(26) << name << ": " << std::fixed << std::setprecision(2)
+              << options.producers * options.messages / elapsed.count() / 1e6 << " M msgs/s"
+              << (sum == expected ? "" : " (lost messages)") << "\n";
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--producers" && i + 1 < argc) {
+            options.producers = std::stoul(argv[++i]);
+        } else if (arg == "--consumers" && i + 1 < argc) {
+            options.consumers = std::stoul(argv[++i]);
+        } else if (arg == "--messages" && i + 1 < argc) {
+            options.messages = std::stoul(argv[++i]);
+        } else if (arg == "--capacity" && i + 1 < argc) {
+            options.capacity = std::stoul(argv[++i]);
+        } else if (arg == "--batch" && i + 1 < argc) {
+            options.batch = std::stoul(argv[++i]);
+        } else {
+            std::cerr << "unknown argument: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    Run<MutexChannel<uint64_t>>("MutexChannel", options);
+    Run<BufferedChannel<uint64_t>>("BufferedChannel", options);
+    if (options.batch > 1) {
+        Run<BufferedChannel<uint64_t>>("BufferedChannel (batched)", options, options.batch);
+    }
+    Run<UnbufferedChannel<uint64_t>>("UnbufferedChannel", options);
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include <malloc.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "thread_basics/concurrent_hash_map.h"
+#include "thread_basics/flat_concurrent_hash_map.h"
+
+// Usage: hash_map_bench [--entries <n>] [--lookups <per thread>] [--threads <t1,t2,...>]
+//                       [--write-percent <p>] [--batch <n>]
+//
+// Fills every map with --entries keys and reports the fill time, heap memory per entry and
+// throughput for every thread count. Every thread runs Find (half hits, half misses), and
+// --write-percent of its operations are Insert/Erase of absent keys. Maps with FindMany are
+// also compared with single-threaded batches of --batch keys.
+
+namespace {
+struct Options {
+    size_t entries = 10'000'000;
+    size_t lookups = 2'000'000;
+    std::vector<size_t> threads = {1, 8, 32, 64};
+    size_t write_percent = 1;
+    size_t batch = 1024;
+};
+
+// Heap bytes in use. Unlike RSS it drops when the previous map is destroyed.
+size_t HeapBytes() {
+    auto info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+uint64_t NextRandom(uint64_t* state) {
+    *state = *state * 6364136223846793005ull + 1442695040888963407ull;
+    return *state >> 17;
+}
+
+// Single-threaded lookups of the same random keys, one by one and in batches.
+template <class Map>
+void RunBatched(Map* map, const Options& options) {
+    std::vector<uint64_t> keys(options.lookups);
+    uint64_t state = 42;
+    for (auto& key : keys) {
+        key = NextRandom(&state) % (options.entries * 2);
+    }
+    std::vector<std::pair<bool, uint64_t>> out(options.batch);
+
+    auto start = std::chrono::steady_clock::now();
+    size_t hits = 0;
+    for (auto key : keys) {
+        hits += map->Find(key).first;
+    }
+    std::chrono::duration<double> single = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    size_t batched_hits = 0;
+    for (size_t i = 0; i < keys.size(); i += options.batch) {
+        auto count = std::min(options.batch, keys.size() - i);
+        batched_hits += map->FindMany(std::span(keys).subspan(i, count), out);
+    }
+    std::chrono::duration<double> batched = std::chrono::steady_clock::now() - start;
+
+    std::cout << "  Find " << std::setprecision(2) << keys.size() / single.count() / 1e6
+              << " M/s, FindMany(" << options.batch << ") "
+              << keys.size() / batched.count() / 1e6 << " M/s"
+              << (hits == batched_hits ? "" : " (results differ)") << "\n";
+}
+
+template <class Map>
+void Run(const std::string& name, const Options& options) {
+    size_t heap_before = HeapBytes();
+    auto start = std::chrono::steady_clock::now();
+    {
+        Map map(static_cast<int>(options.entries), static_cast<int>(options.threads.back()));
+        for (uint64_t key = 0; key < options.entries; ++key) {
+            map.Insert(key * 2, key);
+        }
+        std::chrono::duration<double> fill = std::chrono::steady_clock::now() - start;
+        double bytes_per_entry =
+            static_cast<double>(HeapBytes() - heap_before) / options.entries;
+
+        std::cout << name << ": fill " << std::fixed << std::setprecision(2) << fill.count()
+                  << " s, " << std::setprecision(1) << bytes_per_entry << " bytes/entry\n";
+
+        for (size_t threads_count : options.threads) {
+            std::vector<std::thread> threads;
+            std::atomic<size_t> found{};
+            auto begin = std::chrono::steady_clock::now();
+            for (size_t t = 0; t < threads_count; ++t) {
+                threads.emplace_back([&, t] {
+                    uint64_t state = t + 1;
+                    size_t hits = 0;
+                    for (size_t i = 0; i < options.lookups; ++i) {
+                        // Even keys are present, odd ones are not.
+                        auto key = NextRandom(&state) % (options.entries * 2);
+                        if (NextRandom(&state) % 100 < options.write_percent) {
+                            key |= 1;
+                            if (!map.Insert(key, key)) {
+                                map.Erase(key);
+                            }
+                        } else {
+                            hits += map.Find(key).first;
+                        }
+                    }
+                    found.fetch_add(hits);
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+            std::cout << "  " << std::setw(3) << threads_count << " threads: " << std::setw(8)
+                      << std::setprecision(2)
+                      << threads_count * options.lookups / elapsed.count() / 1e6
+                      << " M ops/s (hits " << std::setprecision(2)
+                      << static_cast<double>(found.load()) / (threads_count * options.lookups)
+                      << ")\n";
+        }
+
+        if constexpr (requires { map.FindMany(std::span<const uint64_t>{}, {}); }) {
+            RunBatched(&map, options);
+        }
+    }
+}
+
+std::vector<size_t> ParseList(const std::string& list) {
+    std::vector<size_t> values;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        values.push_back(std::stoul(list.substr(pos, end - pos)));
+        pos = end + 1;
+    }
+    return values;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--entries" && i + 1 < argc) {
+            options.entries = std::stoul(argv[++i]);
+        } else if (arg == "--lookups" && i + 1 < argc) {
+            options.lookups = std::stoul(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = ParseList(argv[++i]);
+        } else if (arg == "--batch" && i + 1 < argc) {
+            options.batch = std::stoul(argv[++i]);
+        } else if (arg == "--write-percent" && i + 1 < argc) {
+            options.write_percent = std::stoul(argv[++i]);
+        } else {
+            std::cerr << "unknown argument: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    Run<ConcurrentHashMap<uint64_t, uint64_t>>("ConcurrentHashMap", options);
+    Run<FlatConcurrentHashMap<uint64_t, uint64_t>>("FlatConcurrentHashMap", options);
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "thread_basics/concurrent_hash_map.h"
+
+// Usage: hash_map_export_bench [--entries <n>] [--threads <n>]
+//
+// Times a full pass over a ConcurrentHashMap with ForEach, ParallelForEach and Snapshot.
+
+namespace {
+template <class F>
+void Measure(const std::string& name, size_t entries, F run) {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << std::left << std::setw(20) << name << std::right << std::fixed
+              << std::setprecision(3) << std::setw(8) << elapsed.count() << " s, "
+              << std::setprecision(1) << std::setw(8) << entries / elapsed.count() / 1e6
+              << " M entries/s\n";
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t entries = 10'000'000;
+    size_t threads_count = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--entries" && i + 1 < argc) {
+            entries = std::stoul(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads_count = std::stoul(argv[++i]);
+        } else {
+            std::cerr << "unknown argument: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    ConcurrentHashMap<uint64_t, uint64_t> map(static_cast<int>(entries));
+    for (uint64_t key = 0; key < entries; ++key) {
+        map.Insert(key, key);
+    }
+
+    uint64_t sum = 0;
+    Measure("ForEach", entries,
+            [&] { map.ForEach([&](uint64_t, uint64_t value) { sum += value; }); });
+
+    std::atomic<uint64_t> parallel_sum{};
+    Measure("ParallelForEach", entries, [&] {
+        map.ParallelForEach(
+            [&](uint64_t, uint64_t value) {
+                parallel_sum.fetch_add(value, std::memory_order_relaxed);
+            },
+            threads_count);
+    });
+
+    size_t snapshot_size = 0;
+    Measure("Snapshot", entries, [&] { snapshot_size = map.Snapshot().size(); });
+
+    if (sum != parallel_sum.load() || snapshot_size != entries) {
+        std::cerr << "inconsistent results\n";
+        return 1;
+    }
+    return 0;
+}
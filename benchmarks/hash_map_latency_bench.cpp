@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "thread_basics/concurrent_hash_map.h"
+#include "thread_basics/flat_concurrent_hash_map.h"
+
+// Usage: hash_map_latency_bench [--entries <n>] [--readers <n>]
+//
+// Inserts --entries keys into an initially empty map, so that it resizes many times, while
+// --readers threads run Find. Reports Insert latency percentiles.
+
+namespace {
+struct Options {
+    size_t entries = 10'000'000;
+    size_t readers = 2;
+};
+
+template <class Map>
+void Run(const std::string& name, const Options& options) {
+    Map map;
+    std::atomic<bool> done{};
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < options.readers; ++i) {
+        readers.emplace_back([&, i] {
+            uint64_t key = i;
+            while (!done.load(std::memory_order_relaxed)) {
+                map.Find(key);
+                key = (key + 7919) % options.entries;
+            }
+        });
+    }
+
+    std::vector<uint64_t> latencies(options.entries);
+    for (uint64_t key = 0; key < options.entries; ++key) {
+        auto start = std::chrono::steady_clock::now();
+        map.Insert(key, key);
+        latencies[key] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+    }
+    done.store(true);
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        return latencies[std::min(latencies.size() - 1,
+                                  static_cast<size_t>(p / 100 * latencies.size()))];
+    };
+    std::cout << std::left << std::setw(24) << name << std::right << " p50 " << std::setw(8)
+              << percentile(50) << " ns, p99 " << std::setw(8) << percentile(99)
+              << " ns, p99.9 " << std::setw(8) << percentile(99.9) << " ns, max "
+              << std::setw(12) << latencies.back() << " ns\n";
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--entries" && i + 1 < argc) {
+            options.entries = std::stoul(argv[++i]);
+        } else if (arg == "--readers" && i + 1 < argc) {
+            options.readers = std::stoul(argv[++i]);
+        } else {
+            std::cerr << "unknown argument: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    Run<ConcurrentHashMap<uint64_t, uint64_t>>("ConcurrentHashMap", options);
+    Run<FlatConcurrentHashMap<uint64_t, uint64_t>>("FlatConcurrentHashMap", options);
+    return 0;
+}
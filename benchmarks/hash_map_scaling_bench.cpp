@@ -0,0 +1,90 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "thread_basics/concurrent_hash_map.h"
+
+// Usage: hash_map_scaling_bench [--keys <n>] [--ops <per thread>] [--max-threads <n>]
+//                               [--write-percent <p>]
+//
+// Runs a write-heavy mix of Insert/Erase/Find on ConcurrentHashMap for 1, 2, 4, ...,
+// --max-threads threads, with 16 stripes (the former upper bound) and with 4 stripes per
+// thread, and prints the throughput of both.
+
+namespace {
+struct Options {
+    size_t keys = 1'000'000;
+    size_t ops = 1'000'000;
+    size_t max_threads = 128;
+    size_t write_percent = 50;
+};
+
+uint64_t NextRandom(uint64_t* state) {
+    *state = *state * 6364136223846793005ull + 1442695040888963407ull;
+    return *state >> 17;
+}
+
+double Run(const Options& options, size_t threads_count, int stripe_threads) {
+    ConcurrentHashMap<uint64_t, uint64_t> map(static_cast<int>(options.keys), stripe_threads);
+    for (uint64_t key = 0; key < options.keys; key += 2) {
+        map.Insert(key, key);
+    }
+
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < threads_count; ++t) {
+        threads.emplace_back([&, t] {
+            uint64_t state = t + 1;
+            for (size_t i = 0; i < options.ops; ++i) {
+                auto key = NextRandom(&state) % options.keys;
+                if (NextRandom(&state) % 100 < options.write_percent) {
+                    if (!map.Insert(key, key)) {
+                        map.Erase(key);
+                    }
+                } else {
+                    map.Find(key);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return threads_count * options.ops / elapsed.count() / 1e6;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--keys" && i + 1 < argc) {
+            options.keys = std::stoul(argv[++i]);
+        } else if (arg == "--ops" && i + 1 < argc) {
+            options.ops = std::stoul(argv[++i]);
+        } else if (arg == "--max-threads" && i + 1 < argc) {
+            options.max_threads = std::stoul(argv[++i]);
+        } else if (arg == "--write-percent" && i + 1 < argc) {
+            options.write_percent = std::stoul(argv[++i]);
+        } else {
+            std::cerr << "unknown argument: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    std::cout << std::setw(8) << "threads" << std::setw(18) << "16 stripes" << std::setw(18)
+              << "4/thread stripes" << "  (M ops/s)\n";
+    for (size_t threads_count = 1; threads_count <= options.max_threads; threads_count *= 2) {
+        std::cout << std::setw(8) << threads_count << std::fixed << std::setprecision(2)
+                  << std::setw(18) << Run(options, threads_count, 4) << std::setw(18)
+                  << Run(options, threads_count, static_cast<int>(threads_count)) << std::endl;
+    }
+    return 0;
+}
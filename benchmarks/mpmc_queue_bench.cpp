@@ -0,0 +1,193 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "lock_free/mpmc_queue.h"
+
+// Usage: mpmc_queue_bench [--producers <n>] [--consumers <n>] [--messages <per producer>]
+//                         [--capacity <power of two>]
+//
+// Producers enqueue --messages integers each, consumers dequeue until they have seen all of
+// them; both retry with a yield when the queue is full or empty. Reports the throughput of
+// MPMCBoundedQueue and of its previous layout, with head, tail and the slots packed together
+// and seq_cst operations everywhere. BlockingMPMCBoundedQueue runs with its blocking
+// operations instead of the retry loops, MPMCUnboundedQueue ignores --capacity and never makes
+// producers retry.
+
+namespace {
+struct Options {
+    size_t producers = 4;
+    size_t consumers = 4;
+    size_t messages = 1'000'000;
+    size_t capacity = 1024;
+};
+
+template <class T>
+class PackedMPMCBoundedQueue {
+public:
+    explicit PackedMPMCBoundedQueue(size_t size) : max_size_(size), q_(size) {
+        for (size_t i = 0; i < size; ++i) {
+            q_[i].gen_.store(i);
+        }
+    }
+
+    bool Enqueue(const T& value) {
+        if (t_.load() - h_.load() == max_size_) {
+            return false;
+        }
+
+        while (true) {
+            size_t expected = t_.load();
+            if (q_[t_.load() & (max_size_ - 1)].gen_ < expected) {
+                return false;
+            }
+
+            if (!t_.compare_exchange_weak(expected, expected + 1)) {
+                continue;
+            }
+
+            expected &= (max_size_ - 1);
+            q_[expected].val_ = value;
+            q_[expected].gen_.fetch_add(1);
+
+            return true;
+        }
+    }
+
+    bool Dequeue(T& data) {
+        if (t_.load() == h_.load()) {
+            return false;
+        }
+
+        while (true) {
+            size_t expected = h_.load();
+            if (q_[h_ & (max_size_ - 1)].gen_ < expected + 1) {
+                return false;
+            }
+
+            if (!h_.compare_exchange_weak(expected, expected + 1)) {
+                continue;
+            }
+
+            auto old = expected;
+            expected &= (max_size_ - 1);
+            data = std::move(q_[expected].val_);
+            q_[expected].gen_ = old + max_size_;
+
+            return true;
+        }
+    }
+
+private:
+    struct Node {
+        T val_{};
+        std::atomic<size_t> gen_{};
+    };
+
+    size_t max_size_;
+    std::atomic<size_t> sz_{};
+    std::atomic<size_t> h_{};
+    std::atomic<size_t> t_{};
+    std::vector<Node> q_;
+};
+
+template <class Queue>
+void Run(const std::string& name, const Options& options) {
+    std::optional<Queue> holder;
+    if constexpr (std::is_constructible_v<Queue, size_t>) {
+        holder.emplace(options.capacity);
+    } else {
+        holder.emplace();
+    }
+    auto& queue = *holder;
+    std::atomic<size_t> received{};
+    std::vector<uint64_t> sums(options.consumers);
+    std::vector<std::thread> threads;
+    size_t total = options.producers * options.messages;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < options.consumers; ++i) {
+        threads.emplace_back([&, i] {
+            uint64_t sum = 0;
+            if constexpr (requires { queue.BlockingDequeue(); }) {
+                auto count = total / options.consumers + (i < total % options.consumers);
+                for (size_t j = 0; j < count; ++j) {
+                    sum += queue.BlockingDequeue();
+                }
+            } else {
+                uint64_t value;
+                while (received.load(std::memory_order_relaxed) < total) {
+                    if (queue.Dequeue(value)) {
+                        sum += value;
+                        received.fetch_add(1, std::memory_order_relaxed);
+                    } else {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+            sums[i] = sum;
+        });
+    }
+    for (size_t i = 0; i < options.producers; ++i) {
+        threads.emplace_back([&] {
+            for (uint64_t value = 0; value < options.messages; ++value) {
+                if constexpr (requires { queue.BlockingEnqueue(value); }) {
+                    queue.BlockingEnqueue(value);
+                } else if constexpr (std::is_void_v<decltype(queue.Enqueue(value))>) {
+                    queue.Enqueue(value);
+                } else {
+                    while (!queue.Enqueue(value)) {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    uint64_t sum = 0;
+    for (auto value : sums) {
+        sum += value;
+    }
+    uint64_t expected = options.producers * (options.messages * (options.messages - 1) / 2);
+    std::cout << std::setw(26) << name << ": " << std::fixed << std::setprecision(2)
+              << total / elapsed.count() / 1e6 << " M msgs/s"
+              << (sum == expected ? "" : " (lost messages)") << "\n";
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--producers" && i + 1 < argc) {
+            options.producers = std::stoul(argv[++i]);
+        } else if (arg == "--consumers" && i + 1 < argc) {
+            options.consumers = std::stoul(argv[++i]);
+        } else if (arg == "--messages" && i + 1 < argc) {
+            options.messages = std::stoul(argv[++i]);
+        } else if (arg == "--capacity" && i + 1 < argc) {
+            options.capacity = std::stoul(argv[++i]);
+        } else {
+            std::cerr << "unknown argument: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    Run<PackedMPMCBoundedQueue<uint64_t>>("MPMCBoundedQueue (packed)", options);
+    Run<MPMCBoundedQueue<uint64_t>>("MPMCBoundedQueue", options);
+    Run<BlockingMPMCBoundedQueue<uint64_t>>("BlockingMPMCBoundedQueue", options);
+    Run<MPMCUnboundedQueue<uint64_t>>("MPMCUnboundedQueue", options);
+    return 0;
+}
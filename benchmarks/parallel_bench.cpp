@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "executors/parallel_algorithms.h"
+
+// Usage: parallel_bench [--size <n>] [--threads <n>]
+//
+// ParallelFor, ParallelReduce, ParallelSort and ParallelInclusiveScan on --size 32-bit
+// integers against their serial STL counterparts, on a pool of --threads workers.
+
+namespace {
+struct Options {
+    size_t size = 100'000'000;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+uint32_t Hash(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return static_cast<uint32_t>(x);
+}
+
+template <class F>
+double Seconds(F fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+void Report(const std::string& name, double serial, double parallel, bool same) {
+    std::cout << std::setw(14) << name << std::setw(12) << serial << std::setw(12) << parallel
+              << std::setw(12) << serial / parallel << (same ? "" : "  (results differ)")
+              << "\n";
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--size" && i + 1 < argc) {
+            options.size = std::stoul(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = std::stoul(argv[++i]);
+        } else {
+            std::cerr << "unknown argument: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    ThreadPool pool(options.threads);
+    std::vector<uint32_t> serial(options.size);
+    std::vector<uint32_t> parallel(options.size);
+
+    std::cout << std::fixed << std::setprecision(3) << std::setw(14) << "" << std::setw(12)
+              << "serial, s" << std::setw(12) << "parallel, s" << std::setw(12) << "speedup"
+              << "\n";
+
+    auto serial_for = Seconds([&] {
+        for (size_t i = 0; i < options.size; ++i) {
+            serial[i] = Hash(i);
+        }
+    });
+    auto parallel_for = Seconds([&] {
+        ParallelFor(size_t{0}, options.size, 0, [&](size_t i) { parallel[i] = Hash(i); }, pool);
+    });
+    Report("for", serial_for, parallel_for, serial == parallel);
+
+    uint64_t serial_sum = 0;
+    uint64_t parallel_sum = 0;
+    auto serial_reduce = Seconds(
+        [&] { serial_sum = std::accumulate(serial.begin(), serial.end(), uint64_t{0}); });
+    auto parallel_reduce = Seconds([&] {
+        parallel_sum =
+            ParallelReduce(parallel.begin(), parallel.end(), uint64_t{0}, std::plus<>(), 0, pool);
+    });
+    Report("reduce", serial_reduce, parallel_reduce, serial_sum == parallel_sum);
+
+    auto serial_sort = Seconds([&] { std::sort(serial.begin(), serial.end()); });
+    auto parallel_sort =
+        Seconds([&] { ParallelSort(parallel.begin(), parallel.end(), std::less<>(), pool); });
+    Report("sort", serial_sort, parallel_sort, serial == parallel);
+
+    auto serial_scan =
+        Seconds([&] { std::inclusive_scan(serial.begin(), serial.end(), serial.begin()); });
+    auto parallel_scan = Seconds([&] {
+        ParallelInclusiveScan(parallel.begin(), parallel.end(), parallel.begin(), std::plus<>(),
+                              pool);
+    });
+    Report("inclusive_scan", serial_scan, parallel_scan, serial == parallel);
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "executors/thread_pool.h"
+#include "thread_basics/buffered_channel.h"
+
+// Usage: thread_pool_bench [--tasks <n>] [--fib <n>] [--max-threads <n>]
+//
+// Fine-grained task throughput of ThreadPool with --tasks empty tasks submitted from outside
+// and spawned from inside the pool, against a pool of threads reading std::function from a
+// BufferedChannel. Then fork-join scaling: recursive Fib(--fib) with Submit/Get from 1 to
+// --max-threads workers.
+
+namespace {
+struct Options {
+    size_t tasks = 1'000'000;
+    int fib = 38;
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+class ChannelPool {
+public:
+    explicit ChannelPool(size_t threads_count) : tasks_(1024) {
+        for (size_t i = 0; i < threads_count; ++i) {
+            threads_.emplace_back([this] {
+                while (auto task = tasks_.Recv()) {
+                    (*task)();
+                }
+            });
+        }
+    }
+
+    ~ChannelPool() {
+        tasks_.Close();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    void Submit(std::function<void()> task) {
+        tasks_.Send(std::move(task));
+    }
+
+private:
+    BufferedChannel<std::function<void()>> tasks_;
+    std::vector<std::thread> threads_;
+};
+
+void WaitFor(const std::atomic<size_t>& counter, size_t value) {
+    while (counter.load() < value) {
+        std::this_thread::yield();
+    }
+}
+
+template <class Pool>
+double Throughput(const Options& options) {
+    Pool pool(options.max_threads);
+    std::atomic<size_t> done{};
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < options.tasks; ++i) {
+        pool.Submit([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+    }
+    WaitFor(done, options.tasks);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return options.tasks / elapsed.count() / 1e6;
+}
+
+void Spawn(ThreadPool& pool, size_t count, std::atomic<size_t>* done) {
+    while (count > 1) {
+        auto half = count / 2;
+        pool.Submit([&pool, half, done] { Spawn(pool, half, done); });
+        count -= half;
+    }
+    done->fetch_add(1, std::memory_order_relaxed);
+}
+
+double SpawnThroughput(const Options& options) {
+    ThreadPool pool(options.max_threads);
+    std::atomic<size_t> done{};
+    auto start = std::chrono::steady_clock::now();
+    pool.Submit([&] { Spawn(pool, options.tasks, &done); });
+    WaitFor(done, options.tasks);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return options.tasks / elapsed.count() / 1e6;
+}
+
+uint64_t SerialFib(int n) {
+    return n < 2 ? n : SerialFib(n - 1) + SerialFib(n - 2);
+}
+
+uint64_t Fib(ThreadPool& pool, int n) {
+    if (n < 20) {
+        return SerialFib(n);
+    }
+    auto left = pool.Submit([&pool, n] { return Fib(pool, n - 1); });
+    auto right = Fib(pool, n - 2);
+    return left.Get() + right;
+}
+
+double FibSeconds(const Options& options, size_t threads_count) {
+    ThreadPool pool(threads_count);
+    auto start = std::chrono::steady_clock::now();
+    auto result = pool.Submit([&] { return Fib(pool, options.fib); }).Get();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (result != SerialFib(options.fib)) {
+        std::cerr << "wrong result\n";
+    }
+    return elapsed.count();
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--tasks" && i + 1 < argc) {
+            options.tasks = std::stoul(argv[++i]);
+        } else if (arg == "--fib" && i + 1 < argc) {
+            options.fib = std::stoi(argv[++i]);
+        } else if (arg == "--max-threads" && i + 1 < argc) {
+            options.max_threads = std::stoul(argv[++i]);
+        } else {
+            std::cerr << "unknown argument: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << std::setw(26) << "ChannelPool submit" << ": "
+              << Throughput<ChannelPool>(options) << " M tasks/s\n";
+    std::cout << std::setw(26) << "ThreadPool submit" << ": "
+              << Throughput<ThreadPool>(options) << " M tasks/s\n";
+    std::cout << std::setw(26) << "ThreadPool spawn" << ": " << SpawnThroughput(options)
+              << " M tasks/s\n";
+
+    std::cout << "\nFib(" << options.fib << ")\n"
+              << std::setw(8) << "threads" << std::setw(12) << "seconds" << std::setw(12)
+              << "speedup" << "\n";
+    double base = 0;
+    for (size_t threads_count = 1; threads_count <= options.max_threads; threads_count *= 2) {
+        auto seconds = FibSeconds(options, threads_count);
+        if (threads_count == 1) {
+            base = seconds;
+        }
+        std::cout << std::setw(8) << threads_count << std::setw(12) << std::setprecision(3)
+                  << seconds << std::setw(12) << std::setprecision(2) << base / seconds << "\n";
+    }
+    return 0;
+}
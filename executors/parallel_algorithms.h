@@ -0,0 +1,270 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <optional>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "thread_pool.h"
+
+// Data-parallel algorithms on a ThreadPool.
+//
+// Loops use lazy binary splitting: a task walks its range grain elements at a time and splits
+// off the right half only while its worker's deque is empty, i.e. once the halves it split off
+// before have been stolen. A busy pool thus gets a few big tasks, an idle one as many as it can
+// take. A grain of 0 picks one from the range size.
+
+// Runs f and g in parallel and waits for both.
+template <class F, class G>
+void ParallelInvoke(F&& f, G&& g, ThreadPool& pool = ThreadPool::Instance()) {
+    if (!pool.IsWorkerThread()) {
+        pool.Submit([&] { ParallelInvoke(f, g, pool); }).Get();
+        return;
+    }
+    auto left = pool.Submit([&f] { f(); });
+    try {
+        g();
+    } catch (...) {
+        // f may still use the caller's data.
+        left.Wait();
+        throw;
+    }
+    left.Get();
+}
+
+// leaf(begin, end) computes the result of a piece of [begin, end), combine merges the results
+// of adjacent pieces, left to right.
+template <class T, class Leaf, class Combine>
+T SplitRange(ThreadPool& pool, size_t begin, size_t end, size_t grain, Leaf& leaf,
+             Combine& combine) {
+    std::vector<Future<T>> forks;
+    std::optional<T> result;
+    auto append = [&](T value) {
+        if (result) {
+            T merged = combine(std::move(*result), std::move(value));
+            result.emplace(std::move(merged));
+        } else {
+            result.emplace(std::move(value));
+        }
+    };
+
+    std::exception_ptr error;
+    try {
+        while (end - begin > grain) {
+            if (!pool.IsLocalQueueEmpty()) {
+                append(leaf(begin, begin + grain));
+                begin += grain;
+                continue;
+            }
+            auto middle = begin + (end - begin) / 2;
+            forks.push_back(pool.Submit([&pool, middle, end, grain, &leaf, &combine] {
+                return SplitRange<T>(pool, middle, end, grain, leaf, combine);
+            }));
+            end = middle;
+        }
+        append(leaf(begin, end));
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    // The forks use leaf and combine, so they are waited for even after an error. The last
+    // one is the leftmost.
+    for (auto it = forks.rbegin(); it != forks.rend(); ++it) {
+        try {
+            auto value = it->Get();
+            if (!error) {
+                append(std::move(value));
+            }
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return std::move(*result);
+}
+
+template <class T, class Leaf, class Combine>
+T ParallelSplit(ThreadPool& pool, size_t size, size_t grain, Leaf& leaf, Combine& combine) {
+    if (grain == 0) {
+        grain = std::max<size_t>(1, size / (pool.Size() * 64));
+    }
+    if (size <= grain) {
+        return leaf(0, size);
+    }
+    if (!pool.IsWorkerThread()) {
+        return pool.Submit([&] { return SplitRange<T>(pool, 0, size, grain, leaf, combine); })
+            .Get();
+    }
+    return SplitRange<T>(pool, 0, size, grain, leaf, combine);
+}
+
+// Calls fn(i) for every i in [begin, end).
+template <class Index, class F>
+void ParallelFor(Index begin, Index end, size_t grain, F fn,
+                 ThreadPool& pool = ThreadPool::Instance()) {
+    if (!(begin < end)) {
+        return;
+    }
+    auto leaf = [&](size_t from, size_t to) {
+        for (auto i = from; i < to; ++i) {
+            fn(static_cast<Index>(begin + static_cast<Index>(i)));
+        }
+        return std::monostate{};
+    };
+    auto combine = [](std::monostate, std::monostate) { return std::monostate{}; };
+    ParallelSplit<std::monostate>(pool, static_cast<size_t>(end - begin), grain, leaf, combine);
+}
+
+// Like std::reduce, but keeps the order of the elements: op has to be associative only.
+template <class It, class T, class Op = std::plus<>>
+T ParallelReduce(It first, It last, T init, Op op = Op(), size_t grain = 0,
+                 ThreadPool& pool = ThreadPool::Instance()) {
+    if (first == last) {
+        return init;
+    }
+    auto leaf = [&](size_t from, size_t to) {
+        T value(first[from]);
+        for (auto i = from + 1; i < to; ++i) {
+            value = op(std::move(value), first[i]);
+        }
+        return value;
+    };
+    auto combine = [&](T left, T right) { return op(std::move(left), std::move(right)); };
+    return op(std::move(init),
+              ParallelSplit<T>(pool, static_cast<size_t>(last - first), grain, leaf, combine));
+}
+
+// Merges sorted [a, a_end) and [b, b_end) into out, moving the elements. Splits the longer
+// range in the middle and finds the matching point in the other one with a binary search.
+template <class It1, class It2, class Compare>
+void ParallelMerge(It1 a, It1 a_end, It1 b, It1 b_end, It2 out, Compare& comp,
+                   ThreadPool& pool) {
+    constexpr ptrdiff_t kSerialMerge = 1 << 14;
+    if ((a_end - a) + (b_end - b) <= kSerialMerge) {
+        std::merge(std::make_move_iterator(a), std::make_move_iterator(a_end),
+                   std::make_move_iterator(b), std::make_move_iterator(b_end), out, comp);
+        return;
+    }
+
+    It1 a_middle, b_middle;
+    if (a_end - a >= b_end - b) {
+        a_middle = a + (a_end - a) / 2;
+        b_middle = std::lower_bound(b, b_end, *a_middle, comp);
+    } else {
+        b_middle = b + (b_end - b) / 2;
+        a_middle = std::upper_bound(a, a_end, *b_middle, comp);
+    }
+    auto out_middle = out + (a_middle - a) + (b_middle - b);
+    ParallelInvoke(
+        [&] { ParallelMerge(a, a_middle, b, b_middle, out, comp, pool); },
+        [&] { ParallelMerge(a_middle, a_end, b_middle, b_end, out_middle, comp, pool); }, pool);
+}
+
+// Merge sort that sorts [src, src_end) into dst if to_dst, in place otherwise. The halves are
+// sorted into the other array and merged back, so nothing is copied besides the leaves.
+template <class It1, class It2, class Compare>
+void ParallelSortRange(It1 src, It1 src_end, It2 dst, int depth, bool to_dst, Compare& comp,
+                       ThreadPool& pool) {
+    constexpr ptrdiff_t kSerialSort = 1 << 14;
+    auto size = src_end - src;
+    if (depth == 0 || size <= kSerialSort) {
+        std::sort(src, src_end, comp);
+        if (to_dst) {
+            std::move(src, src_end, dst);
+        }
+        return;
+    }
+
+    auto middle = size / 2;
+    ParallelInvoke(
+        [&] { ParallelSortRange(src, src + middle, dst, depth - 1, !to_dst, comp, pool); },
+        [&] {
+            ParallelSortRange(src + middle, src_end, dst + middle, depth - 1, !to_dst, comp, pool);
+        },
+        pool);
+    if (to_dst) {
+        ParallelMerge(src, src + middle, src + middle, src_end, dst, comp, pool);
+    } else {
+        ParallelMerge(dst, dst + middle, dst + middle, dst + size, src, comp, pool);
+    }
+}
+
+// Parallel merge sort, about four leaves per worker. Not stable. Needs a buffer of the size of
+// the range.
+template <class It, class Compare = std::less<>>
+void ParallelSort(It first, It last, Compare comp = Compare(),
+                  ThreadPool& pool = ThreadPool::Instance()) {
+    if (pool.Size() == 1) {
+        std::sort(first, last, comp);
+        return;
+    }
+    int depth = 0;
+    while ((size_t{1} << depth) < 4 * pool.Size()) {
+        ++depth;
+    }
+
+    std::vector<std::iter_value_t<It>> buffer(std::make_move_iterator(first),
+                                              std::make_move_iterator(last));
+    auto sort = [&] {
+        ParallelSortRange(buffer.begin(), buffer.end(), first, depth, true, comp, pool);
+    };
+    if (pool.IsWorkerThread()) {
+        sort();
+    } else {
+        pool.Submit(sort).Get();
+    }
+}
+
+// Like std::inclusive_scan, d_first may be first. Reduces the blocks of the range in
+// parallel, scans the block sums, then scans the blocks in parallel starting from them, so it
+// reads the input twice.
+template <class It, class OutIt, class Op = std::plus<>>
+OutIt ParallelInclusiveScan(It first, It last, OutIt d_first, Op op = Op(),
+                            ThreadPool& pool = ThreadPool::Instance()) {
+    constexpr size_t kMinBlock = 1 << 16;
+    auto size = static_cast<size_t>(last - first);
+    auto blocks = std::min(size / kMinBlock, 4 * pool.Size());
+    if (pool.Size() == 1 || blocks <= 1) {
+        return std::inclusive_scan(first, last, d_first, op);
+    }
+
+    auto block_begin = [&](size_t block) { return size * block / blocks; };
+    std::vector<std::optional<std::iter_value_t<It>>> sums(blocks);
+    auto reduce_block = [&](size_t block) {
+        auto from = block_begin(block);
+        auto to = block_begin(block + 1);
+        std::iter_value_t<It> sum(first[from]);
+        for (auto i = from + 1; i < to; ++i) {
+            sum = op(std::move(sum), first[i]);
+        }
+        sums[block].emplace(std::move(sum));
+    };
+    auto scan_block = [&](size_t block) {
+        auto from = first + block_begin(block);
+        auto to = first + block_begin(block + 1);
+        auto out = d_first + block_begin(block);
+        if (block == 0) {
+            std::inclusive_scan(from, to, out, op);
+        } else {
+            std::inclusive_scan(from, to, out, op, *sums[block - 1]);
+        }
+    };
+
+    // The last block's sum is not needed.
+    ParallelFor(size_t{0}, blocks - 1, 1, reduce_block, pool);
+    for (size_t block = 1; block + 1 < blocks; ++block) {
+        sums[block].emplace(op(*sums[block - 1], std::move(*sums[block])));
+    }
+    ParallelFor(size_t{0}, blocks, 1, scan_block, pool);
+    return d_first + size;
+}
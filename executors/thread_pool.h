@@ -0,0 +1,402 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../lock_free/futex.h"
+#include "../lock_free/work_stealing_deque.h"
+
+class ThreadPool;
+
+// A submitted task together with its result, shared by the pool and the Future.
+class PoolTask {
+public:
+    virtual ~PoolTask() = default;
+
+    bool IsDone() const {
+        return state_.load(std::memory_order_acquire) & kDone;
+    }
+
+    void Release() {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+protected:
+    explicit PoolTask(ThreadPool* pool) : pool_(pool) {
+    }
+
+    virtual void Run() noexcept = 0;
+
+private:
+    friend class ThreadPool;
+    template <class>
+    friend class Future;
+
+    enum State : int {
+        kDone = 1,
+        kWaitedOutside = 2,  // a thread outside the pool sleeps on state_
+        kWaitedInside = 4,   // a worker of the pool sleeps until the pool wakes it
+    };
+
+    void Execute() {
+        Run();
+        Complete();
+        Release();
+    }
+
+    void Complete();
+
+    void WaitOutside() {
+        auto state = state_.load(std::memory_order_acquire);
+        while (!(state & kDone)) {
+            if (!(state & kWaitedOutside) &&
+                !state_.compare_exchange_weak(state, state | kWaitedOutside)) {
+                continue;
+            }
+            FutexWait(&state_, state | kWaitedOutside);
+            state = state_.load(std::memory_order_acquire);
+        }
+    }
+
+    ThreadPool* pool_;
+    std::atomic<int> refs_{2};
+    std::atomic<int> state_{};
+};
+
+template <class R>
+class PoolTaskResult : public PoolTask {
+protected:
+    using PoolTask::PoolTask;
+
+    template <class F>
+    void Store(F& fn) noexcept {
+        try {
+            if constexpr (std::is_void_v<R>) {
+                fn();
+            } else {
+                value_.emplace(fn());
+            }
+        } catch (...) {
+            error_ = std::current_exception();
+        }
+    }
+
+private:
+    template <class>
+    friend class Future;
+
+    std::optional<std::conditional_t<std::is_void_v<R>, bool, R>> value_;
+    std::exception_ptr error_;
+};
+
+// Result of ThreadPool::Submit. Get called from a worker of the same pool runs other tasks
+// while it waits, so tasks may wait for the tasks they submitted without tying up the pool.
+template <class R>
+class Future {
+public:
+    Future() = default;
+
+    explicit Future(PoolTaskResult<R>* task) : task_(task) {
+    }
+
+    Future(Future&& other) noexcept : task_(std::exchange(other.task_, nullptr)) {
+    }
+
+    Future& operator=(Future&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            task_ = std::exchange(other.task_, nullptr);
+        }
+        return *this;
+    }
+
+    ~Future() {
+        Reset();
+    }
+
+    bool Valid() const {
+        return task_ != nullptr;
+    }
+
+    bool IsReady() const {
+        return task_->IsDone();
+    }
+
+    void Wait() const;
+
+    // Returns the result or rethrows the exception of the task. The future is empty afterwards.
+    R Get() {
+        Wait();
+        std::unique_ptr<PoolTaskResult<R>, Releaser> task(std::exchange(task_, nullptr));
+        if (task->error_) {
+            std::rethrow_exception(task->error_);
+        }
+        if constexpr (!std::is_void_v<R>) {
+            return std::move(*task->value_);
+        }
+    }
+
+private:
+    struct Releaser {
+        void operator()(PoolTask* task) const {
+            task->Release();
+        }
+    };
+
+    void Reset() {
+        if (task_) {
+            std::exchange(task_, nullptr)->Release();
+        }
+    }
+
+    PoolTaskResult<R>* task_ = nullptr;
+};
+
+// Work-stealing thread pool.
+//
+// Every worker has a Chase-Lev deque: tasks submitted from a worker go to its own deque and are
+// popped LIFO, idle workers steal FIFO from random victims. Tasks submitted from other threads
+// go to a shared injection queue. Workers that find nothing to do spin for a while and then
+// sleep on a futex; Submit issues a wake syscall only if somebody sleeps.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads_count = std::max(1u, std::thread::hardware_concurrency())) {
+        for (size_t i = 0; i < std::max<size_t>(threads_count, 1); ++i) {
+            workers_.push_back(std::make_unique<Worker>(this, i + 1));
+        }
+        for (auto& worker : workers_) {
+            threads_.emplace_back([this, worker = worker.get()] { WorkerLoop(worker); });
+        }
+    }
+
+    // Runs every task submitted so far, then joins the workers.
+    ~ThreadPool() {
+        stop_.store(true);
+        WakeAll();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    static ThreadPool& Instance() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    size_t Size() const {
+        return workers_.size();
+    }
+
+    template <class F>
+    auto Submit(F&& fn) {
+        using R = std::decay_t<std::invoke_result_t<std::decay_t<F>&>>;
+        auto task = new FunctionTask<R, std::decay_t<F>>(this, std::forward<F>(fn));
+        Schedule(task);
+        return Future<R>(task);
+    }
+
+    bool IsWorkerThread() const {
+        return current_worker_ && current_worker_->pool == this;
+    }
+
+    // True on a worker whose deque has been emptied, by itself or by thieves. Parallel loops
+    // split off more work only then (lazy binary splitting).
+    bool IsLocalQueueEmpty() const {
+        return IsWorkerThread() && current_worker_->deque.Empty();
+    }
+
+private:
+    friend class PoolTask;
+    template <class>
+    friend class Future;
+
+    static constexpr int kSpinRounds = 16;
+
+    template <class R, class F>
+    class FunctionTask final : public PoolTaskResult<R> {
+    public:
+        template <class G>
+        FunctionTask(ThreadPool* pool, G&& fn)
+            : PoolTaskResult<R>(pool), fn_(std::forward<G>(fn)) {
+        }
+
+    private:
+        void Run() noexcept override {
+            this->Store(fn_);
+        }
+
+        F fn_;
+    };
+
+    struct alignas(64) Worker {
+        ThreadPool* pool;
+        uint64_t random;
+        WorkStealingDeque<PoolTask> deque;
+
+        Worker(ThreadPool* pool, uint64_t seed) : pool(pool), random(seed) {
+        }
+    };
+
+    void Schedule(PoolTask* task) {
+        if (IsWorkerThread()) {
+            current_worker_->deque.Push(task);
+        } else {
+            std::lock_guard lock(injection_mutex_);
+            injection_.push_back(task);
+            injected_.fetch_add(1, std::memory_order_relaxed);
+        }
+        WakeOne();
+    }
+
+    PoolTask* FindTask(Worker* self) {
+        if (auto task = self->deque.Pop()) {
+            return task;
+        }
+        if (injected_.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard lock(injection_mutex_);
+            if (!injection_.empty()) {
+                auto task = injection_.front();
+                injection_.pop_front();
+                injected_.fetch_sub(1, std::memory_order_relaxed);
+                return task;
+            }
+        }
+
+        // xorshift64
+        self->random ^= self->random << 13;
+        self->random ^= self->random >> 7;
+        self->random ^= self->random << 17;
+        size_t start = self->random % workers_.size();
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            auto& victim = *workers_[(start + i) % workers_.size()];
+            if (&victim == self) {
+                continue;
+            }
+            if (auto task = victim.deque.Steal()) {
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    bool HasWork() const {
+        if (injected_.load(std::memory_order_relaxed) > 0) {
+            return true;
+        }
+        return std::any_of(workers_.begin(), workers_.end(),
+                           [](auto& worker) { return !worker->deque.Empty(); });
+    }
+
+    void WorkerLoop(Worker* self) {
+        current_worker_ = self;
+        int idle_rounds = 0;
+        while (true) {
+            if (auto task = FindTask(self)) {
+                task->Execute();
+                idle_rounds = 0;
+                continue;
+            }
+            if (stop_.load() && !HasWork()) {
+                return;
+            }
+            if (++idle_rounds < kSpinRounds) {
+                std::this_thread::yield();
+                continue;
+            }
+            Park([] { return false; });
+            idle_rounds = 0;
+        }
+    }
+
+    // Sleeps until Wake* is called, unless there is work or done() holds.
+    template <class Pred>
+    void Park(Pred done) {
+        sleepers_.fetch_add(1);
+        // Pairs with the fence in Wake*: either we see the change or the waker sees us.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto epoch = wake_.load();
+        if (!done() && !stop_.load() && !HasWork()) {
+            FutexWait(&wake_, epoch);
+        }
+        sleepers_.fetch_sub(1);
+    }
+
+    void WakeOne() {
+        Wake(1);
+    }
+
+    void WakeAll() {
+        Wake(-1);
+    }
+
+    void Wake(int count) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers_.load(std::memory_order_relaxed) > 0) {
+            wake_.fetch_add(1);
+            FutexWake(&wake_, count);
+        }
+    }
+
+    void Wait(PoolTask* task) {
+        if (!IsWorkerThread()) {
+            task->WaitOutside();
+            return;
+        }
+        auto self = current_worker_;
+
+        task->state_.fetch_or(PoolTask::kWaitedInside);
+        auto done = [task] { return task->IsDone(); };
+        while (!done()) {
+            if (auto other = FindTask(self)) {
+                other->Execute();
+            } else {
+                Park(done);
+            }
+        }
+    }
+
+    inline static thread_local Worker* current_worker_ = nullptr;
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    std::mutex injection_mutex_;
+    std::deque<PoolTask*> injection_;
+    std::atomic<size_t> injected_{};
+    alignas(64) std::atomic<int> sleepers_{};
+    std::atomic<int> wake_{};
+    std::atomic<bool> stop_{};
+};
+
+inline void PoolTask::Complete() {
+    auto state = state_.fetch_or(kDone);
+    if (state & kWaitedOutside) {
+        FutexWake(&state_, -1);
+    }
+    if (state & kWaitedInside) {
+        // The waiting worker sleeps with the idle ones.
+        pool_->WakeAll();
+    }
+}
+
+template <class R>
+void Future<R>::Wait() const {
+    if (!task_->IsDone()) {
+        task_->pool_->Wait(task_);
+    }
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Epoch-based memory reclamation.
+//
+// Readers wrap every access to shared nodes into an EpochGuard. A writer unlinks a node and
+// passes it to Retire: the node is deleted once every thread that could have seen it has left
+// its guard, i.e. after the global epoch advanced twice.
+class EpochManager {
+public:
+    static EpochManager& Instance() {
+        static EpochManager manager;
+        return manager;
+    }
+
+    EpochManager(const EpochManager&) = delete;
+    EpochManager& operator=(const EpochManager&) = delete;
+
+    // Guards may be nested.
+    void Enter() {
+        auto& local = Local();
+        if (local.nesting++ > 0) {
+            return;
+        }
+        auto epoch = epoch_.load(std::memory_order_relaxed);
+        local.record->state.store((epoch << 1) | 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void Exit() {
+        auto& local = Local();
+        if (--local.nesting == 0) {
+            local.record->state.store(0, std::memory_order_release);
+        }
+    }
+
+    template <class T>
+    void Retire(T* ptr) {
+        Retire(ptr, [](void* p) { delete static_cast<T*>(p); });
+    }
+
+    // Node must be already unreachable for threads that enter a guard after this call.
+    void Retire(void* ptr, void (*deleter)(void*)) {
+        if (shutting_down_.load(std::memory_order_relaxed)) {
+            // Retired by a deleter run at exit, when thread-local states may be gone already.
+            deleter(ptr);
+            return;
+        }
+        auto& local = Local();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        local.retired.push_back({ptr, deleter, epoch_.load(std::memory_order_relaxed)});
+
+        if (local.retired.size() % kCollectPeriod == 0) {
+            Collect();
+        }
+    }
+
+    // Tries to advance the epoch and deletes what is safe to delete.
+    void Collect() {
+        TryAdvance();
+        auto epoch = epoch_.load(std::memory_order_acquire);
+
+        FreeAll(TakeExpired(&Local().retired, epoch));
+        std::vector<Retired> orphans;
+        if (std::unique_lock lock(orphans_mutex_, std::try_to_lock); lock.owns_lock()) {
+            orphans = TakeExpired(&orphans_, epoch);
+        }
+        // Deleters may retire and collect again, so they run without the lock.
+        FreeAll(orphans);
+    }
+
+private:
+    inline static constexpr size_t kCollectPeriod = 64;
+
+    struct Retired {
+        void* ptr;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    // (epoch << 1) | 1 while the thread is inside a guard, 0 otherwise.
+    struct alignas(64) ThreadRecord {
+        std::atomic<uint64_t> state{};
+        std::atomic<bool> in_use{true};
+        ThreadRecord* next = nullptr;
+    };
+
+    struct LocalState {
+        ThreadRecord* record;
+        size_t nesting = 0;
+        std::vector<Retired> retired;
+
+        explicit LocalState(EpochManager* manager) : record(manager->AcquireRecord()) {
+        }
+
+        ~LocalState() {
+            auto& manager = Instance();
+            if (!retired.empty()) {
+                std::lock_guard lock(manager.orphans_mutex_);
+                manager.orphans_.insert(manager.orphans_.end(), retired.begin(), retired.end());
+            }
+            record->in_use.store(false, std::memory_order_release);
+        }
+    };
+
+    EpochManager() = default;
+
+    ~EpochManager() {
+        shutting_down_.store(true, std::memory_order_relaxed);
+        FreeAll(orphans_);
+        auto record = records_.load();
+        while (record) {
+            delete std::exchange(record, record->next);
+        }
+    }
+
+    LocalState& Local() {
+        thread_local LocalState local(this);
+        return local;
+    }
+
+    // Records of exited threads are reused, so their count is bounded by the peak number of
+    // threads.
+    ThreadRecord* AcquireRecord() {
+        for (auto record = records_.load(std::memory_order_acquire); record;
+             record = record->next) {
+            bool free = false;
+            if (!record->in_use.load(std::memory_order_relaxed) &&
+                record->in_use.compare_exchange_strong(free, true)) {
+                return record;
+            }
+        }
+
+        auto record = new ThreadRecord();
+        record->next = records_.load(std::memory_order_relaxed);
+        while (!records_.compare_exchange_weak(record->next, record, std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+        }
+        return record;
+    }
+
+    void TryAdvance() {
+        auto epoch = epoch_.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (auto record = records_.load(std::memory_order_acquire); record;
+             record = record->next) {
+            auto state = record->state.load(std::memory_order_acquire);
+            if ((state & 1) && (state >> 1) != epoch) {
+                return;
+            }
+        }
+        epoch_.compare_exchange_strong(epoch, epoch + 1, std::memory_order_acq_rel);
+    }
+
+    // Deleters may retire more nodes, so the expired ones are taken out before they run.
+    static std::vector<Retired> TakeExpired(std::vector<Retired>* retired, uint64_t epoch) {
+        std::vector<Retired> expired;
+        size_t kept = 0;
+        for (auto& item : *retired) {
+            if (item.epoch + 2 <= epoch) {
+                expired.push_back(item);
+            } else {
+                (*retired)[kept++] = item;
+            }
+        }
+        retired->resize(kept);
+        return expired;
+    }
+
+    static void FreeAll(const std::vector<Retired>& items) {
+        for (auto& item : items) {
+            item.deleter(item.ptr);
+        }
+    }
+
+    std::atomic<uint64_t> epoch_{};
+    std::atomic<ThreadRecord*> records_{};
+    std::mutex orphans_mutex_;
+    std::vector<Retired> orphans_;
+    std::atomic<bool> shutting_down_{};
+};
+
+class EpochGuard {
+public:
+    EpochGuard() {
+        EpochManager::Instance().Enter();
+    }
+    ~EpochGuard() {
+        EpochManager::Instance().Exit();
+    }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <ctime>
+
+// Atomically do the following:
+//    if (*value == expected_value) {
+//        sleep_on_address(value)
+//    }
+inline void FutexWait(int *value, int expected_value) {
+    syscall(SYS_futex, value, FUTEX_WAIT_PRIVATE, expected_value, nullptr, nullptr, 0);
+}
+
+// Wakeup 'count' threads sleeping on address of value(-1 wakes all)
+inline void FutexWake(int *value, int count) {
+    // The kernel stops after the first wakeup for any count below 1.
+    syscall(SYS_futex, value, FUTEX_WAKE_PRIVATE, count < 0 ? INT_MAX : count, nullptr, nullptr,
+            0);
+}
+
+// FutexWait that gives up at the deadline. Returns false if it timed out.
+inline bool FutexWaitUntil(int *value, int expected_value,
+                           std::chrono::steady_clock::time_point deadline) {
+    // steady_clock is CLOCK_MONOTONIC, which FUTEX_WAIT_BITSET uses for absolute timeouts.
+    auto since_epoch = deadline.time_since_epoch();
+    if (since_epoch.count() < 0) {
+        return false;
+    }
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+    auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch - seconds);
+    timespec timeout{static_cast<time_t>(seconds.count()), static_cast<long>(nanoseconds.count())};
+    auto res = syscall(SYS_futex, value, FUTEX_WAIT_BITSET_PRIVATE, expected_value, &timeout,
+                       nullptr, FUTEX_BITSET_MATCH_ANY);
+    return res == 0 || errno != ETIMEDOUT;
+}
+
+static_assert(sizeof(std::atomic<int>) == sizeof(int));
+
+inline void FutexWait(std::atomic<int> *value, int expected_value) {
+    FutexWait(reinterpret_cast<int *>(value), expected_value);
+}
+
+inline bool FutexWaitUntil(std::atomic<int> *value, int expected_value,
+                           std::chrono::steady_clock::time_point deadline) {
+    return FutexWaitUntil(reinterpret_cast<int *>(value), expected_value, deadline);
+}
+
+inline void FutexWake(std::atomic<int> *value, int count) {
+    FutexWake(reinterpret_cast<int *>(value), count);
+}
+
+// Lets threads sleep until some condition changes, without syscalls on the notifying side when
+// nobody sleeps. Bit 0 of the word is set while there are sleepers, the rest counts wakeups.
+class EventCount {
+public:
+    // Sleeps if blocked() still holds after the thread registered as a sleeper. May return
+    // spuriously, callers recheck their condition.
+    template <class Pred>
+    void Wait(Pred blocked) {
+        auto state = word_.load();
+        while (!(state & 1) && !word_.compare_exchange_weak(state, state | 1)) {
+        }
+        // Pairs with the fence in NotifyAll: either we see the new state or it sees the bit.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (blocked()) {
+            FutexWait(&word_, state | 1);
+        }
+    }
+
+    // Wait that gives up at the deadline. Returns false if it timed out.
+    template <class Pred>
+    bool WaitUntil(Pred blocked, std::chrono::steady_clock::time_point deadline) {
+        auto state = word_.load();
+        while (!(state & 1) && !word_.compare_exchange_weak(state, state | 1)) {
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (blocked()) {
+            return FutexWaitUntil(&word_, state | 1, deadline);
+        }
+        return true;
+    }
+
+    // Wakes all sleepers. Call after the state change is published.
+    void NotifyAll() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        NotifyAllFenced();
+    }
+
+    // NotifyAll for callers that issued a seq_cst fence after the state change themselves.
+    void NotifyAllFenced() {
+        auto state = word_.load(std::memory_order_relaxed);
+        if ((state & 1) && word_.compare_exchange_strong(state, (state + 2) & ~1)) {
+            FutexWake(&word_, -1);
+        }
+    }
+
+private:
+    std::atomic<int> word_{};
+};
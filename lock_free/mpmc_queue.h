@@ -3,74 +3,585 @@
 #include <vector>
 #include <utility>
 #include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <thread>
 
+#include "futex.h"
+
+// Vyukov's bounded MPMC queue. The size must be a power of two.
+//
+// Every slot has a generation: gen_ == pos means the slot is free for the producer of position
+// pos, gen_ == pos + 1 means it holds the value for the consumer of pos. Head, tail and every
+// slot live on their own cache lines, so producers and consumers only share the slots they
+// hand over. Values are constructed in the slot on enqueue and destroyed on dequeue, so T needs
+// neither a default constructor nor a copy constructor. If the constructor throws, the claimed
+// slot is handed over marked dead, and the consumer frees it and moves on.
 template <class T>
 class MPMCBoundedQueue {
 public:
     explicit MPMCBoundedQueue(size_t size) : max_size_(size), q_(size) {
+        if (size == 0 || (size & (size - 1)) != 0) {
+            throw std::invalid_argument("MPMCBoundedQueue size must be a power of two");
+        }
         for (size_t i = 0; i < size; ++i) {
-            q_[i].gen_.store(i);
+            q_[i].gen_.store(i, std::memory_order_relaxed);
         }
     }
 
+    MPMCBoundedQueue(const MPMCBoundedQueue&) = delete;
+    MPMCBoundedQueue& operator=(const MPMCBoundedQueue&) = delete;
+
+    ~MPMCBoundedQueue() {
+        auto head = h_.load(std::memory_order_relaxed);
+        auto tail = t_.load(std::memory_order_relaxed);
+        for (; head != tail; ++head) {
+            if (auto& node = q_[head & (max_size_ - 1)]; !node.dead_) {
+                std::destroy_at(node.Value());
+            }
+        }
+    }
+
+    // Returns false if the queue is full, the value is left untouched then.
     bool Enqueue(const T& value) {
-        if (t_.load() - h_.load() == max_size_) {
-            return false;
+        return Emplace(value);
+    }
+
+    bool Enqueue(T&& value) {
+        return Emplace(std::move(value));
+    }
+
+    template <class... Args>
+    bool Emplace(Args&&... args) {
+        return Push(std::forward<Args>(args)...);
+    }
+
+    // If the assignment throws, the value is lost.
+    bool Dequeue(T& data) {
+        return Pop([&](T&& value) { data = std::move(value); });
+    }
+
+    std::optional<T> Dequeue() {
+        std::optional<T> ret;
+        Pop([&](T&& value) { ret.emplace(std::move(value)); });
+        return ret;
+    }
+
+    // Hints, exact only while nobody else touches the queue.
+    bool Full() const {
+        auto pos = t_.load(std::memory_order_relaxed);
+        return q_[pos & (max_size_ - 1)].gen_.load(std::memory_order_acquire) < pos;
+    }
+
+    bool Empty() const {
+        auto pos = h_.load(std::memory_order_relaxed);
+        return q_[pos & (max_size_ - 1)].gen_.load(std::memory_order_acquire) < pos + 1;
+    }
+
+private:
+    template <class>
+    friend class BlockingMPMCBoundedQueue;
+
+    struct alignas(64) Node {
+        std::atomic<size_t> gen_{};
+        bool dead_ = false;
+        alignas(T) unsigned char storage_[sizeof(T)];
+
+        T* Value() {
+            return std::launder(reinterpret_cast<T*>(storage_));
         }
+    };
 
+    template <class... Args>
+    bool Push(Args&&... args) {
+        auto pos = t_.load(std::memory_order_relaxed);
         while (true) {
-            size_t expected = t_.load();
-            if (q_[t_.load() & (max_size_ - 1)].gen_ < expected) {
+            auto& node = q_[pos & (max_size_ - 1)];
+            auto gen = node.gen_.load(std::memory_order_acquire);
+            if (gen == pos) {
+                if (t_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    try {
+                        std::construct_at(node.Value(), std::forward<Args>(args)...);
+                    } catch (...) {
+                        node.dead_ = true;
+                        node.gen_.store(pos + 1, std::memory_order_release);
+                        throw;
+                    }
+                    node.gen_.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (gen < pos) {
+                // The consumer of the previous lap has not freed the slot: full.
                 return false;
+            } else {
+                pos = t_.load(std::memory_order_relaxed);
             }
+        }
+    }
 
-            if (!t_.compare_exchange_weak(expected, expected + 1)) {
-                continue;
+    template <class F>
+    bool Pop(F&& consume) {
+        auto pos = h_.load(std::memory_order_relaxed);
+        while (true) {
+            auto& node = q_[pos & (max_size_ - 1)];
+            auto gen = node.gen_.load(std::memory_order_acquire);
+            if (gen == pos + 1) {
+                if (h_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    if (node.dead_) {
+                        node.dead_ = false;
+                        node.gen_.store(pos + max_size_, std::memory_order_release);
+                        pos = h_.load(std::memory_order_relaxed);
+                        continue;
+                    }
+                    try {
+                        consume(std::move(*node.Value()));
+                    } catch (...) {
+                        std::destroy_at(node.Value());
+                        node.gen_.store(pos + max_size_, std::memory_order_release);
+                        throw;
+                    }
+                    std::destroy_at(node.Value());
+                    node.gen_.store(pos + max_size_, std::memory_order_release);
+                    return true;
+                }
+            } else if (gen < pos + 1) {
+                // Not filled yet: empty.
+                return false;
+            } else {
+                pos = h_.load(std::memory_order_relaxed);
             }
+        }
+    }
+
+    size_t max_size_;
+    std::vector<Node> q_;
+    alignas(64) std::atomic<size_t> h_{};
+    alignas(64) std::atomic<size_t> t_{};
+};
+
+// MPMCBoundedQueue with blocking operations. They spin for a while (on multi-core machines)
+// and then sleep on an EventCount, so the other side issues a wake syscall only if somebody
+// sleeps. The non-blocking operations wake the blocked ones as well.
+template <class T>
+class BlockingMPMCBoundedQueue {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit BlockingMPMCBoundedQueue(size_t size) : queue_(size) {
+    }
 
-            expected &= (max_size_ - 1);
-            q_[expected].val_ = value;
-            q_[expected].gen_.fetch_add(1);
+    bool Enqueue(const T& value) {
+        return EnqueueImpl(value, kTry);
+    }
 
+    bool Enqueue(T&& value) {
+        return EnqueueImpl(std::move(value), kTry);
+    }
+
+    bool Dequeue(T& data) {
+        return DequeueImpl([&](T&& value) { data = std::move(value); }, kTry);
+    }
+
+    std::optional<T> Dequeue() {
+        std::optional<T> ret;
+        DequeueImpl([&](T&& value) { ret.emplace(std::move(value)); }, kTry);
+        return ret;
+    }
+
+    void BlockingEnqueue(const T& value) {
+        EnqueueImpl(value, std::nullopt);
+    }
+
+    void BlockingEnqueue(T&& value) {
+        EnqueueImpl(std::move(value), std::nullopt);
+    }
+
+    T BlockingDequeue() {
+        std::optional<T> ret;
+        DequeueImpl([&](T&& value) { ret.emplace(std::move(value)); }, std::nullopt);
+        return std::move(*ret);
+    }
+
+    // BlockingEnqueue that gives up after the timeout. Returns false then, the value is left
+    // untouched.
+    template <class Rep, class Period>
+    bool BlockingEnqueueFor(const T& value, const std::chrono::duration<Rep, Period>& timeout) {
+        return BlockingEnqueueUntil(value, Deadline(timeout));
+    }
+
+    template <class Rep, class Period>
+    bool BlockingEnqueueFor(T&& value, const std::chrono::duration<Rep, Period>& timeout) {
+        return BlockingEnqueueUntil(std::move(value), Deadline(timeout));
+    }
+
+    bool BlockingEnqueueUntil(const T& value, Clock::time_point deadline) {
+        return EnqueueImpl(value, deadline);
+    }
+
+    bool BlockingEnqueueUntil(T&& value, Clock::time_point deadline) {
+        return EnqueueImpl(std::move(value), deadline);
+    }
+
+    // BlockingDequeue that gives up after the timeout and returns std::nullopt.
+    template <class Rep, class Period>
+    std::optional<T> BlockingDequeueFor(const std::chrono::duration<Rep, Period>& timeout) {
+        return BlockingDequeueUntil(Deadline(timeout));
+    }
+
+    std::optional<T> BlockingDequeueUntil(Clock::time_point deadline) {
+        std::optional<T> ret;
+        DequeueImpl([&](T&& value) { ret.emplace(std::move(value)); }, deadline);
+        return ret;
+    }
+
+private:
+    inline static constexpr int kSpins = 64;
+    // Any deadline in the past: fail right away instead of blocking.
+    inline static const std::optional<Clock::time_point> kTry = Clock::time_point::min();
+
+    template <class Rep, class Period>
+    static Clock::time_point Deadline(const std::chrono::duration<Rep, Period>& timeout) {
+        return Clock::now() + std::chrono::ceil<Clock::duration>(timeout);
+    }
+
+    template <class V>
+    bool EnqueueImpl(V&& value, std::optional<Clock::time_point> deadline) {
+        auto pushed = Retry([&] { return queue_.Enqueue(std::forward<V>(value)); },
+                            [this] { return queue_.Full(); }, &not_full_, deadline);
+        if (pushed) {
+            not_empty_.NotifyAll();
+        }
+        return pushed;
+    }
+
+    template <class F>
+    bool DequeueImpl(F consume, std::optional<Clock::time_point> deadline) {
+        auto popped = Retry([&] { return queue_.Pop(consume); },
+                            [this] { return queue_.Empty(); }, &not_empty_, deadline);
+        if (popped) {
+            not_full_.NotifyAll();
+        }
+        return popped;
+    }
+
+    // Calls op until it succeeds: spins first, then sleeps on event while blocked() holds.
+    template <class Op, class Pred>
+    static bool Retry(Op op, Pred blocked, EventCount* event,
+                      std::optional<Clock::time_point> deadline) {
+        if (op()) {
             return true;
         }
+        if (deadline == kTry) {
+            return false;
+        }
+        static const int spins = std::thread::hardware_concurrency() > 1 ? kSpins : 0;
+        for (int i = 0; i < spins; ++i) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+            if (!blocked() && op()) {
+                return true;
+            }
+        }
+        while (!op()) {
+            if (!deadline) {
+                event->Wait(blocked);
+            } else if (!event->WaitUntil(blocked, *deadline)) {
+                return op();
+            }
+        }
+        return true;
+    }
+
+    MPMCBoundedQueue<T> queue_;
+    alignas(64) EventCount not_full_;
+    alignas(64) EventCount not_empty_;
+};
+
+// Unbounded MPMC queue: a linked list of fixed-size blocks (crossbeam's SegQueue, after
+// Vyukov).
+//
+// Head and tail are positions advanced with a compare-exchange, like in MPMCBoundedQueue, and
+// every lap of kLap positions maps to one block. The last position of a lap is never used: the
+// producer that takes the position before it links the next block and moves the tail over it.
+// A thread touches a block only after it has claimed a position in it, so no fence or EBR guard
+// is needed. Read slots get kRead, and the consumer of the last slot recycles the block; if some
+// slot is still being read, it gets kDestroy and its consumer finishes the job. A slot whose
+// constructor threw gets kDead along with kWrite, and its consumer skips it.
+//
+// Spent blocks go to a pool, so the queue allocates only when it grows beyond its previous size.
+template <class T>
+class MPMCUnboundedQueue {
+public:
+    MPMCUnboundedQueue() {
+        auto block = new Block();
+        head_.block.store(block, std::memory_order_relaxed);
+        tail_.block.store(block, std::memory_order_relaxed);
+    }
+
+    MPMCUnboundedQueue(const MPMCUnboundedQueue&) = delete;
+    MPMCUnboundedQueue& operator=(const MPMCUnboundedQueue&) = delete;
+
+    ~MPMCUnboundedQueue() {
+        auto head = head_.index.load(std::memory_order_relaxed) & ~kHasNext;
+        auto tail = tail_.index.load(std::memory_order_relaxed) & ~kHasNext;
+        auto block = head_.block.load(std::memory_order_relaxed);
+        for (; head != tail; head += kStep) {
+            auto offset = (head >> kShift) % kLap;
+            if (offset < kBlockCap) {
+                if (!(block->slots[offset].state.load(std::memory_order_relaxed) & kDead)) {
+                    std::destroy_at(block->slots[offset].Value());
+                }
+            } else {
+                delete std::exchange(block, block->next.load(std::memory_order_relaxed));
+            }
+        }
+        delete block;
+        for (auto free : free_) {
+            delete free;
+        }
+    }
+
+    void Enqueue(const T& value) {
+        Emplace(value);
+    }
+
+    void Enqueue(T&& value) {
+        Emplace(std::move(value));
     }
 
+    template <class... Args>
+    void Emplace(Args&&... args) {
+        Push(std::forward<Args>(args)...);
+    }
+
+    // Returns false if the queue is empty. If the assignment throws, the value is lost.
     bool Dequeue(T& data) {
-        if (t_.load() == h_.load()) {
-            return false;
+        return Pop([&](T&& value) { data = std::move(value); });
+    }
+
+    std::optional<T> Dequeue() {
+        std::optional<T> ret;
+        Pop([&](T&& value) { ret.emplace(std::move(value)); });
+        return ret;
+    }
+
+private:
+    // Positions are stored shifted by one: the low bit of the head says that the head block
+    // is not the last one, so consumers need not look at the tail.
+    inline static constexpr size_t kShift = 1;
+    inline static constexpr size_t kStep = size_t{1} << kShift;
+    inline static constexpr size_t kHasNext = 1;
+    inline static constexpr size_t kLap = 1024;
+    inline static constexpr size_t kBlockCap = kLap - 1;
+    inline static constexpr size_t kMaxPooledBlocks = 16;
+
+    enum SlotState : int {
+        kWrite = 1,
+        kRead = 2,
+        kDestroy = 4,
+        kDead = 8,
+    };
+
+    struct Slot {
+        std::atomic<int> state{};
+        alignas(T) unsigned char storage_[sizeof(T)];
+
+        T* Value() {
+            return std::launder(reinterpret_cast<T*>(storage_));
+        }
+    };
+
+    struct Block {
+        std::atomic<Block*> next{};
+        Slot slots[kBlockCap];
+    };
+
+    struct alignas(64) Position {
+        std::atomic<size_t> index{};
+        std::atomic<Block*> block{};
+    };
+
+    static void Pause() {
+        static const bool spin = std::thread::hardware_concurrency() > 1;
+        if (spin) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    Block* AcquireBlock() {
+        {
+            std::lock_guard lock(pool_mutex_);
+            if (!free_.empty()) {
+                auto block = free_.back();
+                free_.pop_back();
+                return block;
+            }
         }
+        return new Block();
+    }
 
+    void RecycleBlock(Block* block) {
+        block->next.store(nullptr, std::memory_order_relaxed);
+        for (auto& slot : block->slots) {
+            slot.state.store(0, std::memory_order_relaxed);
+        }
+        {
+            std::lock_guard lock(pool_mutex_);
+            if (free_.size() < kMaxPooledBlocks) {
+                free_.push_back(block);
+                return;
+            }
+        }
+        delete block;
+    }
+
+    // Recycles the block once every slot from start on has been read. Stops at the first
+    // slot whose consumer has not finished yet, and leaves the rest to that consumer.
+    void DestroyBlock(Block* block, size_t start) {
+        for (auto i = start; i + 1 < kBlockCap; ++i) {
+            auto& slot = block->slots[i];
+            if (!(slot.state.load(std::memory_order_acquire) & kRead) &&
+                !(slot.state.fetch_or(kDestroy, std::memory_order_acq_rel) & kRead)) {
+                return;
+            }
+        }
+        RecycleBlock(block);
+    }
+
+    template <class... Args>
+    void Push(Args&&... args) {
+        auto tail = tail_.index.load(std::memory_order_acquire);
+        auto block = tail_.block.load(std::memory_order_acquire);
+        Block* next_block = nullptr;
         while (true) {
-            size_t expected = h_.load();
-            if (q_[h_ & (max_size_ - 1)].gen_ < expected + 1) {
-                return false;
+            auto offset = (tail >> kShift) % kLap;
+            if (offset == kBlockCap) {
+                // Another producer is linking the next block.
+                Pause();
+                tail = tail_.index.load(std::memory_order_acquire);
+                block = tail_.block.load(std::memory_order_acquire);
+                continue;
+            }
+            if (offset + 1 == kBlockCap && !next_block) {
+                next_block = AcquireBlock();
             }
 
-            if (!h_.compare_exchange_weak(expected, expected + 1)) {
+            auto new_tail = tail + kStep;
+            if (!tail_.index.compare_exchange_weak(tail, new_tail, std::memory_order_seq_cst,
+                                                   std::memory_order_acquire)) {
+                block = tail_.block.load(std::memory_order_acquire);
                 continue;
             }
 
-            auto old = expected;
-            expected &= (max_size_ - 1);
-            data = std::move(q_[expected].val_);
-            q_[expected].gen_ = old + max_size_;
+            if (offset + 1 == kBlockCap) {
+                tail_.block.store(next_block, std::memory_order_release);
+                tail_.index.store(new_tail + kStep, std::memory_order_release);
+                block->next.store(next_block, std::memory_order_release);
+            } else if (next_block) {
+                // Lost the last slot to another producer.
+                RecycleBlock(next_block);
+            }
 
-            return true;
+            auto& slot = block->slots[offset];
+            try {
+                std::construct_at(slot.Value(), std::forward<Args>(args)...);
+            } catch (...) {
+                slot.state.fetch_or(kWrite | kDead, std::memory_order_release);
+                throw;
+            }
+            slot.state.fetch_or(kWrite, std::memory_order_release);
+            return;
         }
     }
 
-private:
-    struct Node {
-        Node() = default;
+    template <class F>
+    bool Pop(F&& consume) {
+        auto head = head_.index.load(std::memory_order_acquire);
+        auto block = head_.block.load(std::memory_order_acquire);
+        while (true) {
+            auto offset = (head >> kShift) % kLap;
+            if (offset == kBlockCap) {
+                // Another consumer is moving the head to the next block.
+                Pause();
+                head = head_.index.load(std::memory_order_acquire);
+                block = head_.block.load(std::memory_order_acquire);
+                continue;
+            }
 
-        T val_{};
-        std::atomic<size_t> gen_{};
-    };
+            auto new_head = head + kStep;
+            if (!(new_head & kHasNext)) {
+                auto tail = tail_.index.load(std::memory_order_acquire);
+                if (head >> kShift == tail >> kShift) {
+                    return false;
+                }
+                if ((head >> kShift) / kLap != (tail >> kShift) / kLap) {
+                    new_head |= kHasNext;
+                }
+            }
 
-    size_t max_size_;
-    std::atomic<size_t> sz_{};
-    std::atomic<size_t> h_{};
-    std::atomic<size_t> t_{};
-    std::vector<Node> q_;
+            if (!head_.index.compare_exchange_weak(head, new_head, std::memory_order_seq_cst,
+                                                   std::memory_order_acquire)) {
+                block = head_.block.load(std::memory_order_acquire);
+                continue;
+            }
+
+            if (offset + 1 == kBlockCap) {
+                Block* next;
+                while (!(next = block->next.load(std::memory_order_acquire))) {
+                    Pause();
+                }
+                auto next_index = (new_head & ~kHasNext) + kStep;
+                if (next->next.load(std::memory_order_relaxed)) {
+                    next_index |= kHasNext;
+                }
+                head_.block.store(next, std::memory_order_release);
+                head_.index.store(next_index, std::memory_order_release);
+            }
+
+            // The producer has claimed the slot but may still be writing.
+            auto& slot = block->slots[offset];
+            int state;
+            while (!((state = slot.state.load(std::memory_order_acquire)) & kWrite)) {
+                Pause();
+            }
+            // Marks the slot read; the block may be recycled right after.
+            auto release = [&] {
+                if (offset + 1 == kBlockCap) {
+                    DestroyBlock(block, 0);
+                } else if (slot.state.fetch_or(kRead, std::memory_order_acq_rel) & kDestroy) {
+                    DestroyBlock(block, offset + 1);
+                }
+            };
+            if (state & kDead) {
+                release();
+                head = head_.index.load(std::memory_order_acquire);
+                block = head_.block.load(std::memory_order_acquire);
+                continue;
+            }
+            try {
+                consume(std::move(*slot.Value()));
+            } catch (...) {
+                std::destroy_at(slot.Value());
+                release();
+                throw;
+            }
+            std::destroy_at(slot.Value());
+            release();
+            return true;
+        }
+    }
+
+    alignas(64) Position head_;
+    alignas(64) Position tail_;
+    std::mutex pool_mutex_;
+    std::vector<Block*> free_;
 };
@@ -1,24 +1,6 @@
 #pragma once
 
-#include <linux/futex.h>
-#include <sys/syscall.h>
-#include <sys/time.h>
-#include <unistd.h>
-
-#include <atomic>
-
-// Atomically do the following:
-//    if (*value == expected_value) {
-//        sleep_on_address(value)
-//    }
-void FutexWait(int *value, int expected_value) {
-    syscall(SYS_futex, value, FUTEX_WAIT_PRIVATE, expected_value, nullptr, nullptr, 0);
-}
-
-// Wakeup 'count' threads sleeping on address of value(-1 wakes all)
-void FutexWake(int *value, int count) {
-    syscall(SYS_futex, value, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
-}
+#include "futex.h"
 
 class Mutex {
 public:
@@ -31,7 +13,7 @@ public:
             }
             while (c != 0) {
                 FutexWait(&value_, 2);
-                c = __atomic_exchange_n(&value_, 2, __ATOMIC_SEQ_ST);
+                c = __atomic_exchange_n(&value_, 2, __ATOMIC_SEQ_CST);
             }
         }
     }
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Chase-Lev work-stealing deque of pointers (with the C11 orderings of Le et al., "Correct and
+// Efficient Work-Stealing for Weak Memory Models").
+//
+// The owner thread pushes and pops at the bottom, any thread may steal from the top. The owner
+// only synchronizes with thieves when the deque is down to its last element. The buffer grows
+// as needed; old buffers are kept until the deque dies, since a thief may still read them.
+template <class T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(size_t capacity = 256) {
+        size_t size = 1;
+        while (size < capacity) {
+            size *= 2;
+        }
+        buffers_.push_back(std::make_unique<Buffer>(size));
+        buffer_.store(buffers_.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // Owner only.
+    void Push(T* item) {
+        auto bottom = bottom_.load(std::memory_order_relaxed);
+        auto top = top_.load(std::memory_order_acquire);
+        auto buffer = buffer_.load(std::memory_order_relaxed);
+        if (bottom - top >= static_cast<int64_t>(buffer->size)) {
+            buffer = Grow(buffer, top, bottom);
+        }
+        buffer->At(bottom).store(item, std::memory_order_relaxed);
+        bottom_.store(bottom + 1, std::memory_order_release);
+    }
+
+    // Owner only. Returns the most recently pushed item, nullptr if the deque is empty.
+    T* Pop() {
+        auto bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        auto buffer = buffer_.load(std::memory_order_relaxed);
+        bottom_.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto top = top_.load(std::memory_order_relaxed);
+
+        if (top > bottom) {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        auto item = buffer->At(bottom).load(std::memory_order_relaxed);
+        if (top == bottom) {
+            // The last element, race the thieves for it.
+            if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                              std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Any thread. Returns the oldest item, nullptr if the deque is empty or another thread won
+    // the race for it.
+    T* Steal() {
+        auto top = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto bottom = bottom_.load(std::memory_order_acquire);
+        if (top >= bottom) {
+            return nullptr;
+        }
+        auto item = buffer_.load(std::memory_order_acquire)->At(top).load(
+            std::memory_order_relaxed);
+        if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    // A hint, exact only when nobody touches the deque.
+    bool Empty() const {
+        return bottom_.load(std::memory_order_relaxed) <= top_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Buffer {
+        size_t size;
+        std::unique_ptr<std::atomic<T*>[]> items;
+
+        explicit Buffer(size_t size) : size(size), items(new std::atomic<T*>[size]) {
+        }
+
+        std::atomic<T*>& At(int64_t index) {
+            return items[static_cast<size_t>(index) & (size - 1)];
+        }
+    };
+
+    Buffer* Grow(Buffer* buffer, int64_t top, int64_t bottom) {
+        buffers_.push_back(std::make_unique<Buffer>(buffer->size * 2));
+        auto grown = buffers_.back().get();
+        for (auto i = top; i < bottom; ++i) {
+            grown->At(i).store(buffer->At(i).load(std::memory_order_relaxed),
+                               std::memory_order_relaxed);
+        }
+        buffer_.store(grown, std::memory_order_release);
+        return grown;
+    }
+
+    alignas(64) std::atomic<int64_t> top_{};
+    alignas(64) std::atomic<int64_t> bottom_{};
+    std::atomic<Buffer*> buffer_;
+    std::vector<std::unique_ptr<Buffer>> buffers_;
+};
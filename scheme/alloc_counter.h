@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+
+// Number of global operator new calls so far. Linking alloc_counter.cpp replaces the global
+// operator new and delete of the whole program.
+size_t AllocationCount();
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Bump allocator for parse trees. Nodes are created with std::allocate_shared, so every node
+// holds the arena alive: it is freed at once when the owner and the last node are gone, and
+// can be rewound by the owner in O(1) if no node outlived the evaluation.
+//
+// Allocate is called only from the owner's thread, Deallocate may be called from any thread.
+class ParseArena {
+public:
+    inline static constexpr size_t kChunkSize = 4096;
+
+    ParseArena() = default;
+    ParseArena(const ParseArena&) = delete;
+    ParseArena& operator=(const ParseArena&) = delete;
+
+    void* Allocate(size_t size, size_t align) {
+        live_.fetch_add(1, std::memory_order_relaxed);
+
+        while (true) {
+            if (curr_ < chunks_.size()) {
+                auto& chunk = chunks_[curr_];
+                size_t offset = (used_ + align - 1) & ~(align - 1);
+                if (offset + size <= chunk.size) {
+                    used_ = offset + size;
+                    return chunk.data.get() + offset;
+                }
+                if (curr_ + 1 < chunks_.size()) {
+                    curr_ += 1;
+                    used_ = 0;
+                    continue;
+                }
+            }
+
+            size_t chunk_size = std::max(kChunkSize << chunks_.size(), size + align);
+            chunks_.push_back({std::make_unique<char[]>(chunk_size), chunk_size});
+            curr_ = chunks_.size() - 1;
+            used_ = 0;
+        }
+    }
+
+    void Deallocate() {
+        if (live_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    bool Contains(const void* ptr) const {
+        auto p = static_cast<const char*>(ptr);
+        for (const auto& chunk : chunks_) {
+            if (chunk.data.get() <= p && p < chunk.data.get() + chunk.size) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // True if only the owner's reference is left.
+    bool IsUnused() const {
+        return live_.load(std::memory_order_acquire) == 1;
+    }
+
+    void Reset() {
+        curr_ = 0;
+        used_ = 0;
+    }
+
+    // Arena of the expression being evaluated on this thread, if any.
+    static ParseArena*& Current() {
+        thread_local ParseArena* current = nullptr;
+        return current;
+    }
+
+private:
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    ~ParseArena() = default;
+
+    std::vector<Chunk> chunks_;
+    size_t curr_ = 0;
+    size_t used_ = 0;
+    std::atomic<size_t> live_{1};
+};
+
+template <class T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    ArenaAllocator(ParseArena* arena) : arena_(arena) {
+    }
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena_) {
+    }
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, size_t) {
+        arena_->Deallocate();
+    }
+
+    template <class U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return arena_ == other.arena_;
+    }
+
+    ParseArena* arena_;
+};
+
+// Owner's reference to a ParseArena.
+class ArenaHolder {
+public:
+    ArenaHolder() : arena_(new ParseArena()) {
+    }
+    ~ArenaHolder() {
+        arena_->Deallocate();
+    }
+
+    ArenaHolder(const ArenaHolder&) = delete;
+    ArenaHolder& operator=(const ArenaHolder&) = delete;
+
+    ParseArena* Get() const {
+        return arena_;
+    }
+
+    // Rewinds the arena if nothing allocated in it is alive, otherwise leaves it to the
+    // escaped nodes and starts a new one.
+    void Recycle() {
+        if (arena_->IsUnused()) {
+            arena_->Reset();
+            return;
+        }
+        arena_->Deallocate();
+        arena_ = new ParseArena();
+    }
+
+private:
+    ParseArena* arena_;
+};
+
+// Makes the holder's arena current on this thread and recycles it when the guard is destroyed.
+class ArenaGuard {
+public:
+    explicit ArenaGuard(ArenaHolder* holder) : holder_(holder), prev_(ParseArena::Current()) {
+        ParseArena::Current() = holder_->Get();
+    }
+    ~ArenaGuard() {
+        ParseArena::Current() = prev_;
+        holder_->Recycle();
+    }
+
+    ArenaGuard(const ArenaGuard&) = delete;
+    ArenaGuard& operator=(const ArenaGuard&) = delete;
+
+private:
+    ArenaHolder* holder_;
+    ParseArena* prev_;
+};
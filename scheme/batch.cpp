@@ -0,0 +1,301 @@
+#include "batch.h"
+#include "../executors/thread_pool.h"
+#include <algorithm>
+#include <exception>
+
+void ConstNode::Eval(const BatchContext&, size_t, size_t count, int64_t* out) const {
+    std::fill(out, out + count, value_);
+}
+
+void VarNode::Eval(const BatchContext& ctx, size_t begin, size_t count, int64_t* out) const {
+    std::copy(ctx.columns[idx_] + begin, ctx.columns[idx_] + begin + count, out);
+}
+
+template <typename F>
+void FoldNode<F>::Eval(const BatchContext& ctx, size_t begin, size_t count, int64_t* out) const {
+    args_.front()->Eval(ctx, begin, count, out);
+
+    F op{};
+    std::vector<int64_t> rhs(count);
+    for (size_t i = 1; i < args_.size(); ++i) {
+        args_[i]->Eval(ctx, begin, count, rhs.data());
+        for (size_t j = 0; j < count; ++j) {
+            out[j] = op(out[j], rhs[j]);
+        }
+    }
+}
+
+template <typename F>
+void CompareNode<F>::Eval(const BatchContext& ctx, size_t begin, size_t count,
+                          int64_t* out) const {
+    std::fill(out, out + count, 1);
+    if (args_.empty()) {
+        return;
+    }
+
+    F cmp{};
+    std::vector<int64_t> lhs(count);
+    std::vector<int64_t> rhs(count);
+    args_.front()->Eval(ctx, begin, count, lhs.data());
+    for (size_t i = 1; i < args_.size(); ++i) {
+        args_[i]->Eval(ctx, begin, count, rhs.data());
+        for (size_t j = 0; j < count; ++j) {
+            out[j] &= static_cast<int64_t>(cmp(lhs[j], rhs[j]));
+        }
+        lhs.swap(rhs);
+    }
+}
+
+template <typename F>
+bool FoldNode<F>::IsPure() const {
+    return std::all_of(args_.begin(), args_.end(), [](const auto& arg) { return arg->IsPure(); });
+}
+
+template <typename F>
+bool CompareNode<F>::IsPure() const {
+    return std::all_of(args_.begin(), args_.end(), [](const auto& arg) { return arg->IsPure(); });
+}
+
+void SelectNode::Eval(const BatchContext& ctx, size_t begin, size_t count, int64_t* out) const {
+    std::vector<int64_t> cond(count);
+    std::vector<int64_t> otherwise(count);
+    cond_->Eval(ctx, begin, count, cond.data());
+
+    // The interpreter evaluates only the taken branch, so an impure one may fail or have side
+    // effects on the other rows: it is evaluated row by row.
+    auto eval_branch = [&](const BatchNode& branch, int64_t* dst, bool taken) {
+        if (branch.IsPure()) {
+            branch.Eval(ctx, begin, count, dst);
+            return;
+        }
+        for (size_t j = 0; j < count; ++j) {
+            if (static_cast<bool>(cond[j]) == taken) {
+                branch.Eval(ctx, begin + j, 1, dst + j);
+            }
+        }
+    };
+    eval_branch(*then_, out, true);
+    eval_branch(*otherwise_, otherwise.data(), false);
+
+    for (size_t j = 0; j < count; ++j) {
+        out[j] = cond[j] ? out[j] : otherwise[j];
+    }
+}
+
+void FallbackNode::Eval(const BatchContext& ctx, size_t begin, size_t count, int64_t* out) const {
+    const auto& names = *ctx.names;
+    for (size_t j = 0; j < count; ++j) {
+        for (size_t i = 0; i < names.size(); ++i) {
+            ctx.scope->Assign(names[i], std::make_shared<Number>(ctx.columns[i][begin + j]));
+        }
+
+        auto value = expr_->Eval(*ctx.scope);
+        auto num = As<Number>(value);
+        auto boolean = As<Boolean>(value);
+        if (num && type_ != BatchType::BOOLEAN) {
+            out[j] = num->GetValue();
+        } else if (boolean && type_ != BatchType::NUMBER) {
+            out[j] = boolean->GetValue();
+        } else if (type_ == BatchType::NUMBER) {
+            throw RuntimeError{"batch expression: argument should be a number"};
+        } else if (type_ == BatchType::BOOLEAN) {
+            throw RuntimeError{"If condition must can be evaluated into Boolean"};
+        } else {
+            throw RuntimeError{"batch expression should evaluate to a number or a boolean"};
+        }
+    }
+}
+
+BatchExpression::BatchExpression(const std::shared_ptr<Object>& expr,
+                                 const std::vector<std::string>& vars)
+    : vars_(vars) {
+    if (!expr) {
+        throw RuntimeError{"null expression can not be evaluated"};
+    }
+
+    root_ = Compile(expr, BatchType::ANY);
+}
+
+std::unique_ptr<BatchNode> BatchExpression::Compile(const std::shared_ptr<Object>& expr,
+                                                    BatchType type) const {
+    auto node = TryCompile(expr, type);
+    if (!node || (type != BatchType::ANY && node->GetType() != type)) {
+        return std::make_unique<FallbackNode>(expr, type);
+    }
+    return node;
+}
+
+std::unique_ptr<BatchNode> BatchExpression::TryCompile(const std::shared_ptr<Object>& expr,
+                                                       BatchType type) const {
+    if (auto num = As<Number>(expr)) {
+        return std::make_unique<ConstNode>(num->GetValue(), BatchType::NUMBER);
+    }
+    if (auto boolean = As<Boolean>(expr)) {
+        return std::make_unique<ConstNode>(boolean->GetValue(), BatchType::BOOLEAN);
+    }
+    if (auto symb = As<Symbol>(expr)) {
+        auto it = std::find(vars_.begin(), vars_.end(), symb->GetName());
+        if (it == vars_.end()) {
+            return nullptr;
+        }
+        return std::make_unique<VarNode>(it - vars_.begin());
+    }
+
+    auto cell = As<Cell>(expr);
+    if (!cell) {
+        return nullptr;
+    }
+    auto symb = As<Symbol>(cell->GetFirst());
+    if (!symb) {
+        return nullptr;
+    }
+
+    std::vector<std::shared_ptr<Object>> arg_exprs;
+    auto curr = cell->GetSecond();
+    while (curr) {
+        auto arg_cell = As<Cell>(curr);
+        if (!arg_cell) {
+            return nullptr;
+        }
+        arg_exprs.emplace_back(arg_cell->GetFirst());
+        curr = arg_cell->GetSecond();
+    }
+
+    const auto& name = symb->GetName();
+    if (name == "if") {
+        if (arg_exprs.size() != 3) {
+            return nullptr;
+        }
+        auto cond = Compile(arg_exprs[0], BatchType::BOOLEAN);
+        auto then = Compile(arg_exprs[1], type);
+        auto otherwise = Compile(arg_exprs[2], type);
+        if (!KeepsOrder({cond.get(), then.get(), otherwise.get()})) {
+            return nullptr;
+        }
+        return std::make_unique<SelectNode>(std::move(cond), std::move(then),
+                                            std::move(otherwise));
+    }
+
+    static const std::vector<std::string> kVectorized = {"<",   ">", "=", "<=",  ">=",
+                                                         "+",   "-", "*", "max", "min"};
+    if (std::find(kVectorized.begin(), kVectorized.end(), name) == kVectorized.end()) {
+        return nullptr;
+    }
+    std::vector<std::unique_ptr<BatchNode>> args;
+    std::vector<const BatchNode*> children;
+    for (const auto& arg_expr : arg_exprs) {
+        args.emplace_back(Compile(arg_expr, BatchType::NUMBER));
+        children.push_back(args.back().get());
+    }
+    if (!KeepsOrder(children)) {
+        return nullptr;
+    }
+
+    if (name == "<") {
+        return std::make_unique<CompareNode<std::less<int64_t>>>(std::move(args));
+    }
+    if (name == ">") {
+        return std::make_unique<CompareNode<std::greater<int64_t>>>(std::move(args));
+    }
+    if (name == "=") {
+        return std::make_unique<CompareNode<std::equal_to<int64_t>>>(std::move(args));
+    }
+    if (name == "<=") {
+        return std::make_unique<CompareNode<std::less_equal<int64_t>>>(std::move(args));
+    }
+    if (name == ">=") {
+        return std::make_unique<CompareNode<std::greater_equal<int64_t>>>(std::move(args));
+    }
+
+    if (args.empty()) {
+        if (name == "+") {
+            return std::make_unique<ConstNode>(0, BatchType::NUMBER);
+        }
+        if (name == "*") {
+            return std::make_unique<ConstNode>(1, BatchType::NUMBER);
+        }
+        return nullptr;
+    }
+
+    if (name == "+") {
+        return std::make_unique<FoldNode<std::plus<int64_t>>>(std::move(args));
+    }
+    if (name == "-") {
+        return std::make_unique<FoldNode<std::minus<int64_t>>>(std::move(args));
+    }
+    if (name == "*") {
+        return std::make_unique<FoldNode<std::multiplies<int64_t>>>(std::move(args));
+    }
+    if (name == "max") {
+        return std::make_unique<FoldNode<MaxClass<int64_t>>>(std::move(args));
+    }
+    if (name == "min") {
+        return std::make_unique<FoldNode<MinClass<int64_t>>>(std::move(args));
+    }
+
+    return nullptr;
+}
+
+bool BatchExpression::KeepsOrder(const std::vector<const BatchNode*>& children) {
+    return std::count_if(children.begin(), children.end(),
+                         [](const BatchNode* child) { return !child->IsPure(); }) < 2;
+}
+
+void BatchExpression::EvalRange(const BatchContext& ctx, size_t begin, size_t end,
+                                int64_t* out) const {
+    for (size_t i = begin; i < end; i += kChunkSize) {
+        root_->Eval(ctx, i, std::min(kChunkSize, end - i), out + i);
+    }
+}
+
+std::vector<int64_t> BatchExpression::Evaluate(const BatchColumns& columns, Scope& scope) const {
+    size_t rows = columns.empty() ? 0 : columns.begin()->second.size();
+    for (const auto& [name, column] : columns) {
+        if (column.size() != rows) {
+            throw RuntimeError{"batch columns should have equal sizes"};
+        }
+    }
+
+    BatchContext ctx{{}, &vars_, &scope};
+    for (const auto& name : vars_) {
+        auto it = columns.find(name);
+        if (it == columns.end()) {
+            throw NameError{"no column for variable: " + name};
+        }
+        ctx.columns.emplace_back(it->second.data());
+    }
+
+    std::vector<int64_t> result(rows);
+    auto& pool = ThreadPool::Instance();
+    size_t threads_count =
+        std::min(pool.Size(), (rows + kParallelThreshold - 1) / kParallelThreshold);
+    if (!IsPure() || threads_count < 2) {
+        EvalRange(ctx, 0, rows, result.data());
+        return result;
+    }
+
+    size_t step = (rows / threads_count + kChunkSize) / kChunkSize * kChunkSize;
+    std::vector<Future<void>> chunks;
+    for (size_t begin = step; begin < rows; begin += step) {
+        chunks.push_back(pool.Submit(
+            [&, begin] { EvalRange(ctx, begin, std::min(rows, begin + step), result.data()); }));
+    }
+    // The chunks use ctx and result, so all of them finish before anything is rethrown.
+    std::exception_ptr error;
+    try {
+        EvalRange(ctx, 0, std::min(rows, step), result.data());
+    } catch (...) {
+        error = std::current_exception();
+    }
+    for (auto& chunk : chunks) {
+        chunk.Wait();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    for (auto& chunk : chunks) {
+        chunk.Get();
+    }
+
+    return result;
+}
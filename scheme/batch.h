@@ -0,0 +1,188 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "object.h"
+
+// Columnar input for batch evaluation: one int64 column per free variable.
+using BatchColumns = std::map<std::string, std::vector<int64_t>>;
+
+// ANY is what the root of an expression produces: numbers, or booleans as 0/1.
+enum class BatchType { NUMBER, BOOLEAN, ANY };
+
+struct BatchContext {
+    std::vector<const int64_t*> columns;
+    const std::vector<std::string>* names;
+    Scope* scope;
+};
+
+class BatchNode {
+public:
+    virtual ~BatchNode() = default;
+
+    // Evaluates rows [begin, begin + count) into out[0..count).
+    virtual void Eval(const BatchContext& ctx, size_t begin, size_t count, int64_t* out) const = 0;
+
+    virtual BatchType GetType() const = 0;
+
+    inline virtual bool IsPure() const {
+        return true;
+    }
+};
+
+class ConstNode : public BatchNode {
+public:
+    ConstNode(int64_t value, BatchType type) : value_(value), type_(type) {
+    }
+
+    void Eval(const BatchContext&, size_t, size_t count, int64_t* out) const override;
+
+    inline BatchType GetType() const override {
+        return type_;
+    }
+
+private:
+    int64_t value_;
+    BatchType type_;
+};
+
+class VarNode : public BatchNode {
+public:
+    VarNode(size_t idx) : idx_(idx) {
+    }
+
+    void Eval(const BatchContext& ctx, size_t begin, size_t count, int64_t* out) const override;
+
+    inline BatchType GetType() const override {
+        return BatchType::NUMBER;
+    }
+
+private:
+    size_t idx_;
+};
+
+template <typename F>
+class FoldNode : public BatchNode {
+public:
+    FoldNode(std::vector<std::unique_ptr<BatchNode>> args) : args_(std::move(args)) {
+    }
+
+    void Eval(const BatchContext& ctx, size_t begin, size_t count, int64_t* out) const override;
+
+    inline BatchType GetType() const override {
+        return BatchType::NUMBER;
+    }
+
+    bool IsPure() const override;
+
+private:
+    std::vector<std::unique_ptr<BatchNode>> args_;
+};
+
+template <typename F>
+class CompareNode : public BatchNode {
+public:
+    CompareNode(std::vector<std::unique_ptr<BatchNode>> args) : args_(std::move(args)) {
+    }
+
+    void Eval(const BatchContext& ctx, size_t begin, size_t count, int64_t* out) const override;
+
+    inline BatchType GetType() const override {
+        return BatchType::BOOLEAN;
+    }
+
+    bool IsPure() const override;
+
+private:
+    std::vector<std::unique_ptr<BatchNode>> args_;
+};
+
+class SelectNode : public BatchNode {
+public:
+    SelectNode(std::unique_ptr<BatchNode> cond, std::unique_ptr<BatchNode> then,
+               std::unique_ptr<BatchNode> otherwise)
+        : cond_(std::move(cond)), then_(std::move(then)), otherwise_(std::move(otherwise)) {
+    }
+
+    void Eval(const BatchContext& ctx, size_t begin, size_t count, int64_t* out) const override;
+
+    inline BatchType GetType() const override {
+        return then_->GetType();
+    }
+
+    inline bool IsPure() const override {
+        return cond_->IsPure() && then_->IsPure() && otherwise_->IsPure();
+    }
+
+private:
+    std::unique_ptr<BatchNode> cond_;
+    std::unique_ptr<BatchNode> then_;
+    std::unique_ptr<BatchNode> otherwise_;
+};
+
+// Evaluates a subexpression that can not be vectorized with the interpreter, one row at a
+// time. Its value is checked against the type the parent node expects.
+class FallbackNode : public BatchNode {
+public:
+    FallbackNode(std::shared_ptr<Object> expr, BatchType type)
+        : expr_(std::move(expr)), type_(type) {
+    }
+
+    void Eval(const BatchContext& ctx, size_t begin, size_t count, int64_t* out) const override;
+
+    inline BatchType GetType() const override {
+        return type_;
+    }
+
+    inline bool IsPure() const override {
+        return false;
+    }
+
+private:
+    std::shared_ptr<Object> expr_;
+    BatchType type_;
+};
+
+// An expression compiled for evaluation over a batch of rows. Arithmetic, comparisons and ifs
+// over constants and batch variables are evaluated column-wise; any other subexpression is
+// interpreted row by row, and its vectorized parents use its results as a column.
+class BatchExpression {
+public:
+    inline static constexpr size_t kChunkSize = 1024;
+    inline static constexpr size_t kParallelThreshold = 1 << 16;
+
+    BatchExpression(const std::shared_ptr<Object>& expr, const std::vector<std::string>& vars);
+
+    // Booleans are returned as 0/1. Large batches of pure expressions are split across threads.
+    std::vector<int64_t> Evaluate(const BatchColumns& columns, Scope& scope) const;
+
+    bool IsPure() const {
+        return root_->IsPure();
+    }
+
+    const std::vector<std::string>& GetVars() const {
+        return vars_;
+    }
+
+private:
+    // Returns a node producing values of the given type, a FallbackNode if the subtree can not
+    // be vectorized.
+    std::unique_ptr<BatchNode> Compile(const std::shared_ptr<Object>& expr, BatchType type) const;
+
+    // Returns nullptr if the node itself can not be vectorized.
+    std::unique_ptr<BatchNode> TryCompile(const std::shared_ptr<Object>& expr,
+                                          BatchType type) const;
+
+    // A vectorized node evaluates its children one after another over the whole chunk, so the
+    // side effects of two impure children would interleave across rows differently than in the
+    // interpreter. Such a node falls back as a whole.
+    static bool KeepsOrder(const std::vector<const BatchNode*>& children);
+
+    void EvalRange(const BatchContext& ctx, size_t begin, size_t end, int64_t* out) const;
+
+    std::vector<std::string> vars_;
+    std::shared_ptr<BatchNode> root_;
+};
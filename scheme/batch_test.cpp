@@ -0,0 +1,76 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "scheme.h"
+
+// Checks that RunBatch gives the same values and side effects as running the expression row
+// by row with Run.
+
+namespace {
+const std::vector<std::string> kSetup = {
+    "(define c 0)",
+    "(define (inc) (set! c (+ c 1)) c)",
+};
+
+const std::vector<std::string> kExpressions = {
+    "(+ (* x 2) 1)",
+    "(+ x (inc))",
+    "(- (inc) (inc))",
+    "(< (inc) x (inc))",
+    "(max (* x 2) (+ (inc) (inc)))",
+    "(+ 1 (- (inc) x) (* (inc) 2))",
+    "(if (< x 5) (inc) (- 0 (inc)))",
+    "(if (= (inc) (* x 2)) 1 (inc))",
+    "(if (< x 3) (+ (inc) 100) x)",
+};
+
+int64_t ToInt(const std::string& value) {
+    if (value == "#t" || value == "#f") {
+        return value == "#t";
+    }
+    return std::stoll(value);
+}
+
+bool Check(const std::string& code, const std::vector<int64_t>& xs) {
+    Interpreter batch;
+    Interpreter rows;
+    for (const auto& setup : kSetup) {
+        batch.Run(setup);
+        rows.Run(setup);
+    }
+
+    auto got = batch.RunBatch(batch.Compile(code, {"x"}), {{"x", xs}});
+    bool ok = true;
+    for (size_t i = 0; i < xs.size(); ++i) {
+        rows.Run("(define x " + std::to_string(xs[i]) + ")");
+        auto expected = ToInt(rows.Run(code));
+        if (got[i] != expected) {
+            std::cerr << code << ": row " << i << ": got " << got[i] << ", expected " << expected
+                      << "\n";
+            ok = false;
+        }
+    }
+    if (batch.Run("c") != rows.Run("c")) {
+        std::cerr << code << ": c is " << batch.Run("c") << ", expected " << rows.Run("c")
+                  << "\n";
+        ok = false;
+    }
+    return ok;
+}
+}  // namespace
+
+int main() {
+    std::vector<int64_t> xs;
+    for (int64_t x = 0; x < 3000; ++x) {
+        xs.push_back(x % 10);
+    }
+
+    bool ok = true;
+    for (const auto& code : kExpressions) {
+        ok &= Check(code, xs);
+    }
+    std::cout << (ok ? "OK" : "FAILED") << "\n";
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
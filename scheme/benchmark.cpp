@@ -0,0 +1,263 @@
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "../executors/thread_pool.h"
+#include "alloc_counter.h"
+#include "scheme.h"
+
+// Usage: scheme_bench [--json] [--filter <substring>] [--min-time <seconds>]
+//                     [--parse-file <path>]
+//
+// Prints ns/op, allocations/op and peak RSS for every workload. Every workload runs in its own
+// forked process, so the peak RSS is its own. With --json every workload is printed as one JSON
+// object per line, so results can be stored and diffed across releases.
+
+namespace {
+struct Benchmark {
+    std::string name;
+    std::vector<std::string> setup;
+    std::function<void(Interpreter&)> op;
+};
+
+struct Result {
+    size_t iterations;
+    double ns_per_op;
+    double allocs_per_op;
+    long peak_rss_kb;
+    size_t threads;
+};
+
+std::function<void(Interpreter&)> RunCode(const std::string& code) {
+    return [code](Interpreter& interpreter) { interpreter.Run(code); };
+}
+
+std::string NumbersList(size_t count) {
+    std::string list = "'(";
+    uint64_t x = 42;
+    for (size_t i = 0; i < count; ++i) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        list += std::to_string((x >> 33) % 10000) + " ";
+    }
+    return list + ")";
+}
+
+std::string DeepList(size_t depth) {
+    return "'" + std::string(depth, '(') + "1" + std::string(depth, ')');
+}
+
+std::string LargeProgram(size_t copies) {
+    std::string code;
+    for (size_t i = 0; i < copies; ++i) {
+        code += "(define (fib" + std::to_string(i) +
+                " n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))\n";
+        code += "(list 1 2 3 '(4 5 (6 7)) #t #f (+ 1 2) (quote (a b . c)))\n";
+    }
+    return code;
+}
+
+std::function<void(Interpreter&)> ParseOnly(std::string code) {
+    return [code = std::move(code), arena = std::make_shared<ArenaHolder>()](Interpreter&) {
+        {
+            std::stringstream code_stream(code);
+            Tokenizer tokenizer(&code_stream);
+            while (!tokenizer.IsEnd()) {
+                Read(&tokenizer, arena->Get());
+            }
+        }
+        arena->Recycle();
+    };
+}
+
+const std::string kFib = "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))";
+
+const std::string kTak =
+    "(define (tak x y z) (if (< y x) (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y))"
+    " z))";
+
+const std::string kAckermann =
+    "(define (ack m n) (if (= m 0) (+ n 1) (if (= n 0) (ack (- m 1) 1)"
+    " (ack (- m 1) (ack m (- n 1))))))";
+
+const std::vector<std::string> kQueens = {
+    "(define (ok? row dist placed) (if (null? placed) #t"
+    " (if (= (car placed) (+ row dist)) #f (if (= (car placed) (- row dist)) #f"
+    " (if (= (car placed) row) #f (ok? row (+ dist 1) (cdr placed)))))))",
+    "(define (try-row n row k placed) (if (= row 0) 0"
+    " (+ (if (ok? row 1 placed) (solve n (- k 1) (cons row placed)) 0)"
+    " (try-row n (- row 1) k placed))))",
+    "(define (solve n k placed) (if (= k 0) 1 (try-row n n k placed)))",
+};
+
+const std::vector<std::string> kSort = {
+    "(define (insert x l) (if (null? l) (cons x '()) (if (< x (car l)) (cons x l)"
+    " (cons (car l) (insert x (cdr l))))))",
+    "(define (isort l) (if (null? l) '() (insert (car l) (isort (cdr l)))))",
+};
+
+const std::vector<std::string> kMap = {
+    kFib,
+    "(define (map f l) (if (null? l) '() (cons (f (car l)) (map f (cdr l)))))",
+    "(define (work x) (fib 16))",
+};
+
+// Appends 1000 * 1000 two-character pieces.
+const std::vector<std::string> kAppend = {
+    "(define (append-inner s k) (if (= k 0) s (append-inner (string-append s \"ab\") (- k 1))))",
+    "(define (append-outer s k) (if (= k 0) s (append-outer (append-inner s 1000) (- k 1))))",
+};
+
+std::vector<Benchmark> MakeBenchmarks(const std::string& parse_file) {
+    std::vector<Benchmark> benchmarks = {
+        {"short-expression", {}, RunCode("(+ 1 (* 2 3) (- 10 4))")},
+        {"fib", {kFib}, RunCode("(fib 18)")},
+        {"tak", {kTak}, RunCode("(tak 12 8 4)")},
+        {"ackermann", {kAckermann}, RunCode("(ack 2 9)")},
+        {"nqueens", kQueens, RunCode("(solve 6 6 '())")},
+        {"list-sort", kSort, RunCode("(isort " + NumbersList(200) + ")")},
+        {"list-print-wide", {"(define l " + NumbersList(5000) + ")"}, RunCode("l")},
+        {"list-print-deep", {"(define l " + DeepList(500) + ")"}, RunCode("l")},
+        {"parse-only", {}, ParseOnly(LargeProgram(500))},
+        {"map-fib", kMap, RunCode("(map work '(1 2 3 4 5 6 7 8))")},
+        {"pmap-fib", kMap, RunCode("(pmap work '(1 2 3 4 5 6 7 8))")},
+        {"string-append-1m", kAppend, RunCode("(string-length (append-outer \"\" 1000))")},
+    };
+
+    if (!parse_file.empty()) {
+        std::ifstream in(parse_file);
+        if (!in) {
+            throw std::runtime_error("can not open " + parse_file);
+        }
+        std::stringstream content;
+        content << in.rdbuf();
+        benchmarks.push_back({"parse-file", {}, ParseOnly(content.str())});
+    }
+
+    return benchmarks;
+}
+
+Result Measure(const Benchmark& benchmark, double min_time) {
+    Interpreter interpreter;
+    for (const auto& code : benchmark.setup) {
+        interpreter.Run(code);
+    }
+    benchmark.op(interpreter);
+
+    size_t iterations = 1;
+    while (true) {
+        size_t allocs_before = AllocationCount();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i) {
+            benchmark.op(interpreter);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        size_t allocs = AllocationCount() - allocs_before;
+
+        if (elapsed.count() >= min_time || iterations >= (1u << 30)) {
+            rusage usage{};
+            getrusage(RUSAGE_SELF, &usage);
+            return {iterations, elapsed.count() * 1e9 / iterations,
+                    static_cast<double>(allocs) / iterations, usage.ru_maxrss,
+                    ThreadPool::Instance().Size()};
+        }
+        iterations *= 2;
+    }
+}
+
+// Runs Measure in a child process. The parent never starts the thread pool, so the child
+// does not inherit a pool without threads.
+Result MeasureInChild(const Benchmark& benchmark, double min_time) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        throw std::runtime_error("pipe failed");
+    }
+    std::cout.flush();
+    auto pid = fork();
+    if (pid < 0) {
+        throw std::runtime_error("fork failed");
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        int status = 0;
+        try {
+            auto result = Measure(benchmark, min_time);
+            if (write(fds[1], &result, sizeof(result)) != sizeof(result)) {
+                status = 1;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << benchmark.name << ": " << e.what() << "\n";
+            status = 1;
+        }
+        _exit(status);
+    }
+
+    close(fds[1]);
+    Result result{};
+    auto read_bytes = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (read_bytes != sizeof(result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        throw std::runtime_error(benchmark.name + " failed");
+    }
+    return result;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    bool json = false;
+    std::string filter;
+    std::string parse_file;
+    double min_time = 0.5;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--json") {
+            json = true;
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            min_time = std::stod(argv[++i]);
+        } else if (arg == "--parse-file" && i + 1 < argc) {
+            parse_file = argv[++i];
+        } else {
+            std::cerr << "unknown argument: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    if (!json) {
+        std::cout << std::left << std::setw(20) << "benchmark" << std::right << std::setw(14)
+                  << "ns/op" << std::setw(14) << "allocs/op" << std::setw(16) << "peak RSS, KB"
+                  << "\n";
+    }
+
+    for (const auto& benchmark : MakeBenchmarks(parse_file)) {
+        if (benchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+
+        auto result = MeasureInChild(benchmark, min_time);
+        if (json) {
+            std::cout << "{\"name\":\"" << benchmark.name
+                      << "\",\"iterations\":" << result.iterations
+                      << ",\"ns_per_op\":" << std::fixed << std::setprecision(1) << result.ns_per_op
+                      << ",\"allocs_per_op\":" << result.allocs_per_op
+                      << ",\"peak_rss_kb\":" << result.peak_rss_kb
+                      << ",\"threads\":" << result.threads << "}" << std::endl;
+        } else {
+            std::cout << std::left << std::setw(20) << benchmark.name << std::right
+                      << std::setw(14) << std::fixed << std::setprecision(0) << result.ns_per_op
+                      << std::setw(14) << std::setprecision(1) << result.allocs_per_op
+                      << std::setw(16) << result.peak_rss_kb << std::endl;
+        }
+    }
+
+    return 0;
+}
@@ -1,5 +1,7 @@
 #include "object.h"
-#include <random>
+#include "arena.h"
+#include "../executors/thread_pool.h"
+#include <type_traits>
 
 size_t GetNumberOfArguments(const std::shared_ptr<Object>& head) {
     if (!head) {
@@ -13,6 +15,46 @@ size_t GetNumberOfArguments(const std::shared_ptr<Object>& head) {
     return 1;
 }
 
+std::shared_ptr<Object> CopyOutOfArena(const std::shared_ptr<Object>& obj) {
+    auto arena = ParseArena::Current();
+    if (!arena || !obj || !arena->Contains(obj.get())) {
+        return obj;
+    }
+
+    if (auto num = As<Number>(obj)) {
+        return std::make_shared<Number>(num->GetValue());
+    }
+    if (auto boolean = As<Boolean>(obj)) {
+        return std::make_shared<Boolean>(boolean->GetValue());
+    }
+    if (auto symb = As<Symbol>(obj)) {
+        return std::make_shared<Symbol>(symb->GetName());
+    }
+    if (auto str = As<String>(obj)) {
+        return std::make_shared<String>(str->GetValue());
+    }
+    if (auto chr = As<Char>(obj)) {
+        return std::make_shared<Char>(chr->GetValue());
+    }
+
+    auto cell = As<Cell>(obj);
+    if (!cell) {
+        return obj;
+    }
+    auto head = std::make_shared<Cell>(CopyOutOfArena(cell->GetFirst()), nullptr);
+    auto tail = head;
+    auto curr = cell->GetSecond();
+    while (Is<Cell>(curr) && arena->Contains(curr.get())) {
+        auto next = std::make_shared<Cell>(CopyOutOfArena(As<Cell>(curr)->GetFirst()), nullptr);
+        tail->SetSecond(next);
+        tail = next;
+        curr = As<Cell>(curr)->GetSecond();
+    }
+    tail->SetSecond(CopyOutOfArena(curr));
+
+    return head;
+}
+
 template <class T>
 std::vector<std::shared_ptr<Object>> MakeVector(const std::shared_ptr<Object>& head, Scope& scope) {
     if (!head) {
@@ -353,14 +395,14 @@ std::shared_ptr<Object> Define::Apply(const std::shared_ptr<Object>& head, Scope
             curr_args = As<Cell>(curr_args)->GetSecond();
         }
 
-        auto body = As<Cell>(cell->GetSecond());
+        auto body = CopyOutOfArena(cell->GetSecond());
         auto new_lambda = std::make_shared<LambdaFunction>(&scope, body, args);
         scope.Assign(curr_name, new_lambda);
 
         return nullptr;
     }
 
-    auto value = As<Cell>(cell->GetSecond())->GetFirst()->Eval(scope);
+    auto value = CopyOutOfArena(As<Cell>(cell->GetSecond())->GetFirst()->Eval(scope));
 
     scope.Assign(name->GetName(), value);
 
@@ -374,7 +416,7 @@ std::shared_ptr<Object> Set::Apply(const std::shared_ptr<Object>& head, Scope& s
         throw RuntimeError{"Set should define a symbol"};
     }
     Scope* to_assign = scope.CheckToSet(name->GetName());
-    auto value = As<Cell>(cell->GetSecond())->GetFirst()->Eval(scope);
+    auto value = CopyOutOfArena(As<Cell>(cell->GetSecond())->GetFirst()->Eval(scope));
 
     to_assign->Assign(name->GetName(), value);
 
@@ -394,6 +436,7 @@ std::shared_ptr<Object> SetPair<car>::Apply(const std::shared_ptr<Object>& head,
     if (Is<Cell>(new_value)) {
         new_value = new_value->Eval(scope);
     }
+    new_value = CopyOutOfArena(new_value);
 
     if constexpr (car) {
         auto old_second = As<Cell>(scope.At(name->GetName()))->GetSecond();
@@ -409,19 +452,6 @@ std::shared_ptr<Object> SetPair<car>::Apply(const std::shared_ptr<Object>& head,
 }
 
 std::shared_ptr<Object> CreateLambda::Apply(const std::shared_ptr<Object>& head, Scope& scope) {
-    static auto gen_lambda_name = []() -> std::string {
-        static std::mt19937 rnd(time(0));
-        static std::uniform_int_distribution<int> dist(0, 25);
-        size_t len = 10;
-        std::string name;
-        for (size_t i = 0; i < len; ++i) {
-            name.push_back(static_cast<char>('a' + dist(rnd)));
-        }
-
-        return name;
-    };
-
-    auto curr_name = gen_lambda_name();
     auto cell = As<Cell>(head);
     std::vector<std::string> args;
     auto curr_args = cell->GetFirst();
@@ -430,38 +460,364 @@ std::shared_ptr<Object> CreateLambda::Apply(const std::shared_ptr<Object>& head,
         curr_args = As<Cell>(curr_args)->GetSecond();
     }
 
-    auto body = As<Cell>(cell->GetSecond());
-    auto lambda = std::make_shared<LambdaFunction>(&scope, body, args);
-    scope.Assign(curr_name, lambda);
-
-    return lambda;
+    auto body = CopyOutOfArena(cell->GetSecond());
+    return std::make_shared<LambdaFunction>(&scope, body, args);
 }
 
-std::shared_ptr<Object> LambdaFunction::Apply(const std::shared_ptr<Object>& head, Scope&) {
-    auto& scope = GetScope();
-    auto args = GetArgs();
-    auto body = As<Cell>(GetBody());
-
+std::shared_ptr<Object> LambdaFunction::Apply(const std::shared_ptr<Object>& head, Scope& scope) {
+    std::vector<std::shared_ptr<Object>> values;
     auto cell = As<Cell>(head);
-    for (size_t i = 0; i < args.size(); ++i) {
-        auto arg = cell->GetFirst()->Eval(scope);
-        scope.Assign(args[i], arg);
+    for (size_t i = 0; i < args_.size(); ++i) {
+        if (!cell) {
+            throw RuntimeError{"lambda expects " + std::to_string(args_.size()) + " arguments"};
+        }
+        values.emplace_back(cell->GetFirst()->Eval(scope));
         cell = As<Cell>(cell->GetSecond());
     }
 
+    return Call(values);
+}
+
+std::shared_ptr<Object> LambdaFunction::Call(const std::vector<std::shared_ptr<Object>>& args) {
+    if (args.size() != args_.size()) {
+        throw RuntimeError{"lambda expects " + std::to_string(args_.size()) + " arguments"};
+    }
+
+    // Lives as long as the closures created by the call.
+    auto call_scope = std::make_shared<Scope>(scope_.get());
+    auto& new_scope = *call_scope;
+    for (size_t i = 0; i < args_.size(); ++i) {
+        new_scope.Assign(args_[i], CopyOutOfArena(args[i]));
+    }
+
     std::shared_ptr<Object> res;
-    LambdaFunction::k_scopes.emplace_back(std::make_shared<Scope>(&scope));
-    auto& new_scope = LambdaFunction::k_scopes.back();
-    new_scope->GetVars() = scope.GetVars();
+    auto body = As<Cell>(body_);
     while (body) {
-        res = body->GetFirst()->Eval(*new_scope);
+        res = body->GetFirst()->Eval(new_scope);
         body = As<Cell>(body->GetSecond());
     }
 
     return res;
 }
 
-std::map<std::string, std::shared_ptr<Function>> Symbol::k_functions =
+void AsyncCall::Run() {
+    int expected = PENDING;
+    if (!state_.compare_exchange_strong(expected, RUNNING)) {
+        return;
+    }
+
+    std::shared_ptr<Object> result;
+    std::exception_ptr error;
+    try {
+        result = lambda_->Call(args_);
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    {
+        std::lock_guard lock(mutex_);
+        result_ = std::move(result);
+        error_ = error;
+        lambda_.reset();
+        args_.clear();
+        state_.store(DONE);
+    }
+    done_.notify_all();
+    Scope::AddAsyncCalls(-1);
+}
+
+std::shared_ptr<Object> AsyncCall::Touch() {
+    Run();
+
+    std::unique_lock lock(mutex_);
+    done_.wait(lock, [this] { return state_.load() == DONE; });
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+    return result_;
+}
+
+namespace {
+std::shared_ptr<AsyncCall> Spawn(std::shared_ptr<LambdaFunction> lambda,
+                                 std::vector<std::shared_ptr<Object>> args) {
+    auto future = std::make_shared<AsyncCall>(std::move(lambda), std::move(args));
+    // Touch waits on the AsyncCall, so the Future of the pool is dropped.
+    ThreadPool::Instance().Submit([future] { future->Run(); });
+    return future;
+}
+}  // namespace
+
+std::shared_ptr<Object> MakeFuture::Apply(const std::shared_ptr<Object>& head, Scope& scope) {
+    if (GetNumberOfArguments(head) != 1 || !Is<Cell>(head)) {
+        throw RuntimeError{"future expects 1 argument"};
+    }
+    auto lambda = As<LambdaFunction>(As<Cell>(head)->GetFirst()->Eval(scope));
+    if (!lambda || !lambda->GetArgs().empty()) {
+        throw RuntimeError{"future expects a lambda without arguments"};
+    }
+
+    return Spawn(lambda, {});
+}
+
+std::shared_ptr<Object> Touch::Apply(const std::shared_ptr<Object>& head, Scope& scope) {
+    if (GetNumberOfArguments(head) != 1 || !Is<Cell>(head)) {
+        throw RuntimeError{"touch expects 1 argument"};
+    }
+    auto value = As<Cell>(head)->GetFirst()->Eval(scope);
+    if (auto future = As<AsyncCall>(value)) {
+        return future->Touch();
+    }
+    return value;
+}
+
+std::shared_ptr<Object> ParallelMap::Apply(const std::shared_ptr<Object>& head, Scope& scope) {
+    if (GetNumberOfArguments(head) != 2 || !Is<Cell>(head)) {
+        throw RuntimeError{"pmap expects 2 arguments"};
+    }
+    auto cell = As<Cell>(head);
+    auto lambda = As<LambdaFunction>(cell->GetFirst()->Eval(scope));
+    if (!lambda || lambda->GetArgs().size() != 1) {
+        throw RuntimeError{"pmap expects a lambda with 1 argument"};
+    }
+
+    std::vector<std::shared_ptr<AsyncCall>> futures;
+    auto list = As<Cell>(cell->GetSecond())->GetFirst()->Eval(scope);
+    while (list) {
+        auto elem = As<Cell>(list);
+        if (!elem) {
+            throw RuntimeError{"pmap expects a proper list"};
+        }
+        futures.emplace_back(Spawn(lambda, {elem->GetFirst()}));
+        list = elem->GetSecond();
+    }
+
+    std::shared_ptr<Object> result;
+    for (auto it = futures.rbegin(); it != futures.rend(); ++it) {
+        result = std::make_shared<Cell>((*it)->Touch(), result);
+    }
+    return result;
+}
+
+String::~String() {
+    if (IsLeaf()) {
+        return;
+    }
+
+    // Long ropes are deep, so children are released iteratively.
+    std::vector<std::shared_ptr<String>> stack;
+    stack.emplace_back(std::move(left_));
+    stack.emplace_back(std::move(right_));
+    while (!stack.empty()) {
+        auto node = std::move(stack.back());
+        stack.pop_back();
+        if (node.use_count() == 1 && !node->IsLeaf()) {
+            stack.emplace_back(std::move(node->left_));
+            stack.emplace_back(std::move(node->right_));
+        }
+    }
+}
+
+std::shared_ptr<String> String::Concat(const std::shared_ptr<String>& lhs,
+                                       const std::shared_ptr<String>& rhs) {
+    if (lhs->Length() == 0) {
+        return rhs;
+    }
+    if (rhs->Length() == 0) {
+        return lhs;
+    }
+    if (lhs->Length() + rhs->Length() <= kLeafSize) {
+        return std::make_shared<String>(lhs->GetValue() + rhs->GetValue());
+    }
+
+    // Appending a short piece: merge it into the rightmost leaf to keep ropes shallow.
+    if (!lhs->IsLeaf() && lhs->right_->IsLeaf() &&
+        lhs->right_->Length() + rhs->Length() <= kLeafSize) {
+        return std::make_shared<String>(
+            lhs->left_, std::make_shared<String>(lhs->right_->value_ + rhs->GetValue()));
+    }
+
+    return std::make_shared<String>(lhs, rhs);
+}
+
+void String::AppendTo(std::string* out, size_t begin, size_t end) const {
+    struct Frame {
+        const String* node;
+        size_t offset;
+    };
+
+    std::vector<Frame> stack{{this, 0}};
+    while (!stack.empty()) {
+        auto [node, offset] = stack.back();
+        stack.pop_back();
+        if (offset >= end || offset + node->length_ <= begin) {
+            continue;
+        }
+
+        if (node->IsLeaf()) {
+            size_t from = std::max(begin, offset) - offset;
+            size_t to = std::min(end, offset + node->length_) - offset;
+            out->append(node->value_, from, to - from);
+            continue;
+        }
+        stack.push_back({node->right_.get(), offset + node->left_->length_});
+        stack.push_back({node->left_.get(), offset});
+    }
+}
+
+std::string String::Stringify() {
+    std::string res = "\"";
+    for (char c : GetValue()) {
+        if (c == '"' || c == '\\') {
+            res.push_back('\\');
+        } else if (c == '\n') {
+            res += "\\n";
+            continue;
+        } else if (c == '\t') {
+            res += "\\t";
+            continue;
+        }
+        res.push_back(c);
+    }
+    res.push_back('"');
+
+    return res;
+}
+
+namespace {
+std::shared_ptr<Object> EvalNthArgument(const std::shared_ptr<Object>& head, size_t n,
+                                        Scope& scope) {
+    auto cell = As<Cell>(head);
+    while (n > 0 && cell) {
+        cell = As<Cell>(cell->GetSecond());
+        n -= 1;
+    }
+    if (!cell) {
+        throw RuntimeError{"not enough arguments"};
+    }
+    return cell->GetFirst()->Eval(scope);
+}
+
+template <class T>
+std::shared_ptr<T> EvalNthArgumentAs(const std::shared_ptr<Object>& head, size_t n, Scope& scope,
+                                     const std::string& name) {
+    auto value = As<T>(EvalNthArgument(head, n, scope));
+    if (!value) {
+        throw RuntimeError{name + ": argument " + std::to_string(n + 1) + " has wrong type"};
+    }
+    return value;
+}
+}  // namespace
+
+std::shared_ptr<Object> MakeString::Apply(const std::shared_ptr<Object>& head, Scope& scope) {
+    std::string value;
+    for (const auto& chr : MakeVector<Char>(head, scope)) {
+        value.push_back(As<Char>(chr)->GetValue());
+    }
+    return std::make_shared<String>(std::move(value));
+}
+
+std::shared_ptr<Object> StringAppend::Apply(const std::shared_ptr<Object>& head, Scope& scope) {
+    auto res = std::make_shared<String>("");
+    for (const auto& str : MakeVector<String>(head, scope)) {
+        res = String::Concat(res, As<String>(str));
+    }
+    return res;
+}
+
+std::shared_ptr<Object> Substring::Apply(const std::shared_ptr<Object>& head, Scope& scope) {
+    auto args = GetNumberOfArguments(head);
+    if (args != 2 && args != 3) {
+        throw RuntimeError{"substring expects 2 or 3 arguments"};
+    }
+
+    auto str = EvalNthArgumentAs<String>(head, 0, scope, "substring");
+    auto begin = EvalNthArgumentAs<Number>(head, 1, scope, "substring")->GetValue();
+    int64_t end = str->Length();
+    if (args == 3) {
+        end = EvalNthArgumentAs<Number>(head, 2, scope, "substring")->GetValue();
+    }
+    if (begin < 0 || begin > end || end > static_cast<int64_t>(str->Length())) {
+        throw RuntimeError{"substring: index out of range"};
+    }
+
+    std::string value;
+    str->AppendTo(&value, begin, end);
+    return std::make_shared<String>(std::move(value));
+}
+
+std::shared_ptr<Object> StringLength::Apply(const std::shared_ptr<Object>& head, Scope& scope) {
+    if (GetNumberOfArguments(head) != 1) {
+        throw RuntimeError{"string-length expects 1 argument"};
+    }
+    auto str = EvalNthArgumentAs<String>(head, 0, scope, "string-length");
+    return std::make_shared<Number>(str->Length());
+}
+
+std::shared_ptr<Object> StringRef::Apply(const std::shared_ptr<Object>& head, Scope& scope) {
+    if (GetNumberOfArguments(head) != 2) {
+        throw RuntimeError{"string-ref expects 2 arguments"};
+    }
+    auto str = EvalNthArgumentAs<String>(head, 0, scope, "string-ref");
+    auto idx = EvalNthArgumentAs<Number>(head, 1, scope, "string-ref")->GetValue();
+    if (idx < 0 || idx >= static_cast<int64_t>(str->Length())) {
+        throw RuntimeError{"string-ref: index out of range"};
+    }
+
+    std::string value;
+    str->AppendTo(&value, idx, idx + 1);
+    return std::make_shared<Char>(value.front());
+}
+
+std::shared_ptr<Object> NumberToString::Apply(const std::shared_ptr<Object>& head, Scope& scope) {
+    if (GetNumberOfArguments(head) != 1) {
+        throw RuntimeError{"number->string expects 1 argument"};
+    }
+    auto num = EvalNthArgumentAs<Number>(head, 0, scope, "number->string");
+    return std::make_shared<String>(std::to_string(num->GetValue()));
+}
+
+std::shared_ptr<Object> OpenOutputString::Apply(const std::shared_ptr<Object>& head, Scope&) {
+    if (head) {
+        throw RuntimeError{"open-output-string expects no arguments"};
+    }
+    return std::make_shared<StringPort>();
+}
+
+std::shared_ptr<Object> GetOutputString::Apply(const std::shared_ptr<Object>& head,
+                                               Scope& scope) {
+    if (GetNumberOfArguments(head) != 1) {
+        throw RuntimeError{"get-output-string expects 1 argument"};
+    }
+    auto port = EvalNthArgumentAs<StringPort>(head, 0, scope, "get-output-string");
+    return std::make_shared<String>(port->GetValue());
+}
+
+template <class T>
+std::shared_ptr<Object> WriteToPort<T>::Apply(const std::shared_ptr<Object>& head, Scope& scope) {
+    if (GetNumberOfArguments(head) != 2) {
+        throw RuntimeError{"writing to a port expects a value and a port"};
+    }
+    auto value = EvalNthArgument(head, 0, scope);
+    // The empty list is a null pointer, which is no Object for Is.
+    bool empty_list = !value && std::is_same_v<T, Object>;
+    if (!empty_list && !Is<T>(value)) {
+        throw RuntimeError{"writing to a port: argument 1 has wrong type"};
+    }
+    auto port = EvalNthArgumentAs<StringPort>(head, 1, scope, "writing to a port");
+
+    if (empty_list) {
+        port->Write("()");
+    } else if (auto str = As<String>(value)) {
+        port->Write(*str);
+    } else if (auto chr = As<Char>(value)) {
+        port->Write(std::string(1, chr->GetValue()));
+    } else {
+        port->Write(value->Stringify());
+    }
+    return nullptr;
+}
+
+const std::map<std::string, std::shared_ptr<Function>> Symbol::k_functions =
     std::map<std::string, std::shared_ptr<Function>>{
         {"quote", std::make_shared<ReturnItself>()},
         {"boolean?", std::make_shared<IsBoolean>()},
@@ -497,4 +853,20 @@ std::map<std::string, std::shared_ptr<Function>> Symbol::k_functions =
         {"set-car!", std::make_shared<SetCar>()},
         {"set-cdr!", std::make_shared<SetCdr>()},
         {"lambda", std::make_shared<CreateLambda>()},
+        {"future", std::make_shared<MakeFuture>()},
+        {"touch", std::make_shared<Touch>()},
+        {"pmap", std::make_shared<ParallelMap>()},
+        {"string?", std::make_shared<IsString>()},
+        {"char?", std::make_shared<IsChar>()},
+        {"string", std::make_shared<MakeString>()},
+        {"string-append", std::make_shared<StringAppend>()},
+        {"substring", std::make_shared<Substring>()},
+        {"string-length", std::make_shared<StringLength>()},
+        {"string-ref", std::make_shared<StringRef>()},
+        {"number->string", std::make_shared<NumberToString>()},
+        {"open-output-string", std::make_shared<OpenOutputString>()},
+        {"get-output-string", std::make_shared<GetOutputString>()},
+        {"write-string", std::make_shared<WriteString>()},
+        {"write-char", std::make_shared<WriteChar>()},
+        {"display", std::make_shared<Display>()},
     };
\ No newline at end of file
@@ -7,6 +7,12 @@
 #include "error.h"
 #include <functional>
 #include <vector>
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <condition_variable>
+#include <exception>
 
 class Scope;
 
@@ -40,74 +46,84 @@ inline bool Is(const std::shared_ptr<Object>& obj) {
     return dynamic_cast<T*>(obj.get()) != nullptr;
 }
 
-class Scope {
+// Scopes of lambdas and their calls are owned by shared pointers: every scope keeps its
+// ancestor alive if that one is shared too, so a closure keeps the scopes it refers to.
+//
+// Futures read and write scopes from pool threads, so every scope has a lock. It is taken only
+// while some future is pending or running: otherwise only the thread that would start the next
+// one touches the scopes.
+class Scope : public std::enable_shared_from_this<Scope> {
 public:
     Scope() = default;
-    Scope(Scope* anc_scope) : anc_scope_(anc_scope) {
-    }
-    Scope(const Scope& other) : anc_scope_(other.anc_scope_), vars_(other.vars_) {
-    }
-    Scope& operator=(Scope& other) {
-        anc_scope_ = other.anc_scope_;
-        vars_ = other.vars_;
-
-        return *this;
+    Scope(Scope* anc_scope)
+        : anc_scope_(anc_scope),
+          anc_owner_(anc_scope ? anc_scope->weak_from_this().lock() : nullptr) {
     }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
 
     Scope* CheckToSet(const std::string& name) {
-        if (vars_.find(name) == vars_.end()) {
-            Scope* anc = anc_scope_;
-            while (true) {
-                if (!anc) {
-                    throw NameError{"no variable with name: " + name + " in all parent scopes"};
-                }
-
-                auto t = anc->vars_.find(name);
-                if (t != anc->vars_.end()) {
-                    return anc;
-                }
-                anc = anc->anc_scope_;
+        for (auto scope = this; scope; scope = scope->anc_scope_) {
+            if (scope->Find(name)) {
+                return scope;
             }
         }
-
-        return this;
+        throw NameError{"no variable with name: " + name + " in all parent scopes"};
     }
 
     std::shared_ptr<Object> At(const std::string& name) const {
-        auto it = vars_.find(name);
-
-        if (it == vars_.end()) {
-            Scope* anc = anc_scope_;
-            while (true) {
-                if (!anc) {
-                    throw NameError{"no variable with name: " + name + " in all parent scopes"};
-                }
-
-                auto t = anc->vars_.find(name);
-                if (t != anc->vars_.end()) {
-                    return t->second;
-                }
-                anc = anc->anc_scope_;
+        for (auto scope = this; scope; scope = scope->anc_scope_) {
+            if (auto value = scope->Find(name)) {
+                return std::move(*value);
             }
         }
-
-        return it->second;
+        throw NameError{"no variable with name: " + name + " in all parent scopes"};
     }
 
     void Assign(const std::string& name, const std::shared_ptr<Object>& value) {
+        std::unique_lock lock(mutex_, std::defer_lock);
+        if (IsShared()) {
+            lock.lock();
+        }
         vars_[name] = value;
     }
 
     void Clear() {
+        std::unique_lock lock(mutex_, std::defer_lock);
+        if (IsShared()) {
+            lock.lock();
+        }
         vars_.clear();
     }
 
-    auto& GetVars() {
-        return vars_;
+    // Called when a future is created and when it has finished.
+    static void AddAsyncCalls(int delta) {
+        async_calls_.fetch_add(delta, std::memory_order_acq_rel);
     }
 
 private:
+    static bool IsShared() {
+        return async_calls_.load(std::memory_order_acquire) > 0;
+    }
+
+    // The value of name in this scope only, nullopt if there is none.
+    std::optional<std::shared_ptr<Object>> Find(const std::string& name) const {
+        std::shared_lock lock(mutex_, std::defer_lock);
+        if (IsShared()) {
+            lock.lock();
+        }
+        auto it = vars_.find(name);
+        if (it == vars_.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    inline static std::atomic<int> async_calls_{};
+
     Scope* anc_scope_ = nullptr;
+    std::shared_ptr<Scope> anc_owner_;
+    mutable std::shared_mutex mutex_;
     std::map<std::string, std::shared_ptr<Object>> vars_{};
 };
 
@@ -158,8 +174,117 @@ private:
     int64_t value_;
 };
 
+// Immutable string. Leaves keep their text in std::string, so short strings are stored inline.
+// string-append builds a rope of concatenation nodes instead of copying, so building a long
+// string piece by piece takes linear time.
+class String : public Object {
+public:
+    // Concatenations shorter than this are copied into a single leaf.
+    inline static constexpr size_t kLeafSize = 256;
+
+    String(std::string value) : value_(std::move(value)), length_(value_.size()) {
+    }
+    String(std::shared_ptr<String> left, std::shared_ptr<String> right)
+        : left_(std::move(left)), right_(std::move(right)),
+          length_(left_->length_ + right_->length_) {
+    }
+
+    ~String() override;
+
+    static std::shared_ptr<String> Concat(const std::shared_ptr<String>& lhs,
+                                          const std::shared_ptr<String>& rhs);
+
+    inline size_t Length() const {
+        return length_;
+    }
+
+    // Appends characters [begin, end) to out.
+    void AppendTo(std::string* out, size_t begin, size_t end) const;
+
+    inline std::string GetValue() const {
+        std::string value;
+        value.reserve(length_);
+        AppendTo(&value, 0, length_);
+        return value;
+    }
+
+    inline std::shared_ptr<Object> Eval(Scope&) override {
+        return shared_from_this();
+    }
+
+    std::string Stringify() override;
+
+private:
+    inline bool IsLeaf() const {
+        return !left_;
+    }
+
+    std::string value_;
+    std::shared_ptr<String> left_;
+    std::shared_ptr<String> right_;
+    size_t length_;
+};
+
+class Char : public Object {
+public:
+    Char(char value) : value_(value) {
+    }
+
+    inline char GetValue() const {
+        return value_;
+    }
+
+    inline std::shared_ptr<Object> Eval(Scope&) override {
+        return shared_from_this();
+    }
+
+    inline std::string Stringify() override {
+        if (value_ == ' ') {
+            return "#\\space";
+        }
+        if (value_ == '\n') {
+            return "#\\newline";
+        }
+        if (value_ == '\t') {
+            return "#\\tab";
+        }
+        return std::string("#\\") + value_;
+    }
+
+private:
+    char value_;
+};
+
+// Output string port: accumulates written text in one buffer.
+class StringPort : public Object {
+public:
+    inline void Write(const std::string& text) {
+        std::lock_guard lock(mutex_);
+        buffer_ += text;
+    }
+
+    inline void Write(const String& text) {
+        std::lock_guard lock(mutex_);
+        text.AppendTo(&buffer_, 0, text.Length());
+    }
+
+    inline std::string GetValue() {
+        std::lock_guard lock(mutex_);
+        return buffer_;
+    }
+
+    inline std::string Stringify() override {
+        return "#<output-port>";
+    }
+
+private:
+    std::mutex mutex_;
+    std::string buffer_;
+};
+
 class Symbol : public Object {
-    static std::map<std::string, std::shared_ptr<Function>> k_functions;
+    // Read-only after static initialization, so it is safe to look up from any thread.
+    static const std::map<std::string, std::shared_ptr<Function>> k_functions;
 
 public:
     Symbol(const std::string& value) : value_(value) {
@@ -188,16 +313,11 @@ private:
 };
 
 class LambdaFunction : public Object {
-    inline static std::vector<std::shared_ptr<Scope>> k_scopes{};
-
 public:
     LambdaFunction() = default;
     LambdaFunction(Scope* anc_scope, const std::shared_ptr<Object>& body,
-                   const std::vector<std::string>& args) {
-        k_scopes.emplace_back(std::make_shared<Scope>(anc_scope));
-        scope_ = k_scopes.back();
-        body_ = body;
-        args_ = args;
+                   const std::vector<std::string>& args)
+        : scope_(std::make_shared<Scope>(anc_scope)), body_(body), args_(args) {
     }
     LambdaFunction(const LambdaFunction& other)
         : scope_(other.scope_), body_(other.body_), args_(other.args_) {
@@ -205,6 +325,10 @@ public:
 
     std::shared_ptr<Object> Apply(const std::shared_ptr<Object>& head, Scope& scope) override;
 
+    // Calls the lambda with already evaluated arguments. The lambda's own scope is not
+    // modified, so one lambda can be called from several threads at once.
+    std::shared_ptr<Object> Call(const std::vector<std::shared_ptr<Object>>& args);
+
     Scope& GetScope() {
         return *scope_;
     }
@@ -244,6 +368,10 @@ public:
         return second_;
     }
 
+    inline void SetSecond(std::shared_ptr<Object> second) {
+        second_ = std::move(second);
+    }
+
     inline std::shared_ptr<Object> Eval(Scope& scope) override {
         if (!first_) {
             throw RuntimeError{"empty object in cell"};
@@ -252,11 +380,6 @@ public:
         if (!eval) {
             throw RuntimeError{"apply on empty object in cell"};
         }
-        if (Is<LambdaFunction>(eval) && Is<Cell>(second_) &&
-            Is<Cell>(As<Cell>(second_)->GetFirst()) && As<Cell>(second_)->GetSecond() == nullptr) {
-            auto new_args = As<Cell>(second_)->GetFirst()->Eval(scope);
-            return eval->Apply(std::make_shared<Cell>(new_args, nullptr), scope);
-        }
         return eval->Apply(second_, scope);
     }
 
@@ -306,6 +429,10 @@ private:
 };
 
 size_t GetNumberOfArguments(const std::shared_ptr<Object>&);
+
+// Copies nodes allocated in the current parse arena to the heap, so that values stored in
+// scopes do not keep the arena alive.
+std::shared_ptr<Object> CopyOutOfArena(const std::shared_ptr<Object>&);
 template <class T>
 std::vector<std::shared_ptr<Object>> MakeVector(const std::shared_ptr<Object>&, Scope&);
 
@@ -323,6 +450,8 @@ public:
 using IsBoolean = IsType<Boolean>;
 using IsNumber = IsType<Number>;
 using IsSymbol = IsType<Symbol>;
+using IsString = IsType<String>;
+using IsChar = IsType<Char>;
 
 class Not : public Function {
 public:
@@ -456,4 +585,99 @@ using SetCdr = SetPair<false>;
 class CreateLambda : public Function {
 public:
     std::shared_ptr<Object> Apply(const std::shared_ptr<Object>&, Scope&) override;
-};
\ No newline at end of file
+};
+
+// Result of a lambda call scheduled on the thread pool.
+class AsyncCall : public Object {
+public:
+    AsyncCall(std::shared_ptr<LambdaFunction> lambda, std::vector<std::shared_ptr<Object>> args)
+        : lambda_(std::move(lambda)), args_(std::move(args)) {
+        Scope::AddAsyncCalls(1);
+    }
+
+    // Runs the call unless it is already started by another thread.
+    void Run();
+
+    // Waits for the result, running the call inline if no worker has picked it up yet.
+    std::shared_ptr<Object> Touch();
+
+    inline std::string Stringify() override {
+        return "#<future>";
+    }
+
+private:
+    enum State { PENDING, RUNNING, DONE };
+
+    std::shared_ptr<LambdaFunction> lambda_;
+    std::vector<std::shared_ptr<Object>> args_;
+    std::atomic<int> state_{PENDING};
+    std::mutex mutex_;
+    std::condition_variable done_;
+    std::shared_ptr<Object> result_;
+    std::exception_ptr error_;
+};
+
+class MakeFuture : public Function {
+public:
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Object>&, Scope&) override;
+};
+
+class Touch : public Function {
+public:
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Object>&, Scope&) override;
+};
+
+class ParallelMap : public Function {
+public:
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Object>&, Scope&) override;
+};
+
+class MakeString : public Function {
+public:
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Object>&, Scope&) override;
+};
+
+class StringAppend : public Function {
+public:
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Object>&, Scope&) override;
+};
+
+class Substring : public Function {
+public:
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Object>&, Scope&) override;
+};
+
+class StringLength : public Function {
+public:
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Object>&, Scope&) override;
+};
+
+class StringRef : public Function {
+public:
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Object>&, Scope&) override;
+};
+
+class NumberToString : public Function {
+public:
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Object>&, Scope&) override;
+};
+
+class OpenOutputString : public Function {
+public:
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Object>&, Scope&) override;
+};
+
+class GetOutputString : public Function {
+public:
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Object>&, Scope&) override;
+};
+
+template <class T>
+class WriteToPort : public Function {
+public:
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Object>&, Scope&) override;
+};
+
+using WriteString = WriteToPort<String>;
+using WriteChar = WriteToPort<Char>;
+using Display = WriteToPort<Object>;
\ No newline at end of file
@@ -1,8 +1,16 @@
 #include "parser.h"
-#include <vector>
-#include <iostream>
 
-std::shared_ptr<Object> Read(Tokenizer* tokenizer) {
+namespace {
+template <class T, class... Args>
+std::shared_ptr<T> Make(ParseArena* arena, Args&&... args) {
+    if (!arena) {
+        return std::make_shared<T>(std::forward<Args>(args)...);
+    }
+    return std::allocate_shared<T>(ArenaAllocator<T>(arena), std::forward<Args>(args)...);
+}
+}  // namespace
+
+std::shared_ptr<Object> Read(Tokenizer* tokenizer, ParseArena* arena) {
     if (tokenizer->IsEnd()) {
         throw SyntaxError{"in Read: empty list"};
     }
@@ -22,38 +30,45 @@ std::shared_ptr<Object> Read(Tokenizer* tokenizer) {
             }
             tokenizer->Next();
 
-            auto list = ReadList(tokenizer);
+            auto list = ReadList(tokenizer, arena);
             if (!list) {
-                return std::make_shared<Cell>(std::make_shared<Symbol>("quote"), nullptr);
+                return Make<Cell>(arena, Make<Symbol>(arena, "quote"), nullptr);
             }
-            return std::make_shared<Cell>(std::make_shared<Symbol>("quote"),
-                                          std::make_shared<Cell>(list, nullptr));
+            return Make<Cell>(arena, Make<Symbol>(arena, "quote"),
+                              Make<Cell>(arena, list, nullptr));
         } else {
-            return std::make_shared<Cell>(std::make_shared<Symbol>("quote"), Read(tokenizer));
+            return Make<Cell>(arena, Make<Symbol>(arena, "quote"), Read(tokenizer, arena));
         }
     } else if (ConstantToken* x = std::get_if<ConstantToken>(&token)) {
-        return std::make_shared<Number>(x->value);
+        return Make<Number>(arena, x->value);
     } else if (BooleanToken* x = std::get_if<BooleanToken>(&token)) {
-        return std::make_shared<Boolean>(x->value);
+        return Make<Boolean>(arena, x->value);
     } else if (SymbolToken* x = std::get_if<SymbolToken>(&token)) {
-        return std::make_shared<Symbol>(x->name);
+        return Make<Symbol>(arena, std::move(x->name));
+    } else if (StringToken* x = std::get_if<StringToken>(&token)) {
+        return Make<String>(arena, std::move(x->value));
+    } else if (CharToken* x = std::get_if<CharToken>(&token)) {
+        return Make<Char>(arena, x->value);
     } else if (BracketToken* x = std::get_if<BracketToken>(&token)) {
         if (*x != BracketToken::OPEN) {
             throw SyntaxError{"in Read: expected ("};
         }
 
-        return ReadList(tokenizer);
+        return ReadList(tokenizer, arena);
     }
 
     throw SyntaxError{"in Read: bad pattern"};
 }
 
-std::shared_ptr<Object> ReadList(Tokenizer* tokenizer) {
-    std::vector<std::shared_ptr<Object>> list;
+std::shared_ptr<Object> ReadList(Tokenizer* tokenizer, ParseArena* arena) {
+    std::shared_ptr<Cell> head;
+    std::shared_ptr<Cell> tail;
+    std::shared_ptr<Object> second;
+    std::shared_ptr<Object> after_dot;
 
+    size_t sz = 0;
     size_t number_of_dots = 0;
-    size_t dot_pos;
-    size_t curr_pos = 0;
+    size_t after_dot_count = 0;
     while (true) {
         if (tokenizer->IsEnd()) {
             throw SyntaxError{"in ReadList: expected )"};
@@ -72,39 +87,47 @@ std::shared_ptr<Object> ReadList(Tokenizer* tokenizer) {
             if (number_of_dots > 1) {
                 throw SyntaxError{"in ReadList: incorrect list"};
             }
-            dot_pos = curr_pos;
-            curr_pos += 1;
             tokenizer->Next();
-            list.emplace_back(nullptr);
             continue;
         }
 
-        list.emplace_back(Read(tokenizer));
-        curr_pos += 1;
+        auto elem = Read(tokenizer, arena);
+        if (number_of_dots > 0) {
+            after_dot = elem;
+            after_dot_count += 1;
+            continue;
+        }
+
+        auto cell = Make<Cell>(arena, elem, nullptr);
+        if (!head) {
+            head = cell;
+        } else {
+            tail->SetSecond(cell);
+        }
+        tail = cell;
+
+        sz += 1;
+        if (sz == 2) {
+            second = elem;
+        }
     }
 
-    size_t sz = list.size();
     if (number_of_dots == 0) {
-        if (list.empty()) {
+        if (!head) {
             return nullptr;
         }
 
-        std::shared_ptr<Object> cell = std::make_shared<Cell>(list[sz - 1], nullptr);
-        for (int i = sz - 2; i >= 0; --i) {
-            cell = std::make_shared<Cell>(list[i], cell);
-        }
-
-        if (auto symb = As<Symbol>(list.front())) {
+        if (auto symb = As<Symbol>(head->GetFirst())) {
             if (symb->GetName() == "if" && !(sz == 3 || sz == 4)) {
                 throw SyntaxError{"if should have condition and 1 or 2 statements"};
             }
             if (symb->GetName() == "define" || symb->GetName() == "set!") {
                 if (sz == 4) {
-                    if (!Is<Cell>(list[1])) {
+                    if (!Is<Cell>(second)) {
                         throw SyntaxError{symb->GetName() +
                                           " with more than 2 arguments should define lambda"};
                     }
-                    return cell;
+                    return head;
                 }
                 if (sz != 3) {
                     throw SyntaxError{symb->GetName() + " should have 2 arguments"};
@@ -117,25 +140,15 @@ std::shared_ptr<Object> ReadList(Tokenizer* tokenizer) {
             }
         }
 
-        return cell;
+        return head;
     } else {
-        if (dot_pos + 2 != sz) {
+        if (after_dot_count != 1 || sz == 0) {
             throw SyntaxError{"in ReadList: incorrect improper list with dot_pos = " +
-                              std::to_string(dot_pos) + " and sz = " + std::to_string(sz)};
-        }
-
-        if (sz < 3) {
-            throw SyntaxError{"in ReadList: incorrect improper list with dot_pos = " +
-                              std::to_string(dot_pos) + " and sz = " + std::to_string(sz)};
-        }
-
-        std::shared_ptr<Object> cell = std::make_shared<Cell>(list[sz - 3], list[sz - 1]);
-        if (sz > 3) {
-            for (int i = sz - 4; i >= 0; --i) {
-                cell = std::make_shared<Cell>(list[i], cell);
-            }
+                              std::to_string(sz) +
+                              " and sz = " + std::to_string(sz + 1 + after_dot_count)};
         }
 
-        return cell;
+        tail->SetSecond(after_dot);
+        return head;
     }
 }
\ No newline at end of file
@@ -2,9 +2,11 @@
 
 #include <memory>
 
+#include "arena.h"
 #include "object.h"
 #include "tokenizer.h"
 
-std::shared_ptr<Object> Read(Tokenizer* tokenizer);
+// Nodes are allocated in the arena if one is given, and on the heap otherwise.
+std::shared_ptr<Object> Read(Tokenizer* tokenizer, ParseArena* arena = nullptr);
 
-std::shared_ptr<Object> ReadList(Tokenizer* tokenizer);
\ No newline at end of file
+std::shared_ptr<Object> ReadList(Tokenizer* tokenizer, ParseArena* arena = nullptr);
\ No newline at end of file
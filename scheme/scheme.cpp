@@ -1,10 +1,10 @@
 #include "scheme.h"
 
-std::string Interpreter::Run(const std::string& code) {
+std::shared_ptr<Object> Interpreter::Parse(const std::string& code, ParseArena* arena) {
     std::stringstream code_stream(code);
     Tokenizer tokenizer(&code_stream);
 
-    auto result = Read(&tokenizer);
+    auto result = Read(&tokenizer, arena);
     if (!tokenizer.IsEnd()) {
         throw SyntaxError{"code can not be parsed"};
     }
@@ -12,9 +12,26 @@ std::string Interpreter::Run(const std::string& code) {
         throw RuntimeError{"null expression can not be evaluated"};
     }
 
+    return result;
+}
+
+std::string Interpreter::Run(const std::string& code) {
+    ArenaGuard guard(&arena_);
+    auto result = Parse(code, arena_.Get());
+
     auto to_string = result->Eval(global_scope_);
     if (!to_string) {
         return "()";
     }
     return to_string->Stringify();
+}
+
+BatchExpression Interpreter::Compile(const std::string& code,
+                                     const std::vector<std::string>& vars) {
+    return BatchExpression(Parse(code), vars);
+}
+
+std::vector<int64_t> Interpreter::RunBatch(const BatchExpression& expr,
+                                           const BatchColumns& columns) {
+    return expr.Evaluate(columns, batch_scope_);
 }
\ No newline at end of file
@@ -2,12 +2,23 @@
 
 #include "parser.h"
 #include "object.h"
+#include "batch.h"
 #include <sstream>
 
 class Interpreter {
 public:
     std::string Run(const std::string&);
 
+    // Compiles an expression over the given free variables for RunBatch.
+    BatchExpression Compile(const std::string& code, const std::vector<std::string>& vars);
+
+    // Evaluates the expression for every row of the columns, see BatchExpression::Evaluate.
+    std::vector<int64_t> RunBatch(const BatchExpression& expr, const BatchColumns& columns);
+
 private:
+    std::shared_ptr<Object> Parse(const std::string& code, ParseArena* arena = nullptr);
+
+    ArenaHolder arena_;
     Scope global_scope_{};
-};
\ No newline at end of file
+    Scope batch_scope_{&global_scope_};
+};
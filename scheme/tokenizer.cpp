@@ -20,6 +20,14 @@ bool BooleanToken::operator==(const BooleanToken& other) const {
     return value == other.value;
 }
 
+bool StringToken::operator==(const StringToken& other) const {
+    return value == other.value;
+}
+
+bool CharToken::operator==(const CharToken& other) const {
+    return value == other.value;
+}
+
 bool Tokenizer::IsEnd() {
     return in_->eof() || in_->peek() == EOF;
 }
@@ -52,7 +60,15 @@ Token Tokenizer::GetToken() {
         in_->unget();
         return Token{DotToken{}};
     }
+    if (curr == '"') {
+        in_->unget();
+        return ReadString();
+    }
     if (curr == '#') {
+        if (!IsEnd() && in_->peek() == '\\') {
+            in_->unget();
+            return ReadChar();
+        }
         if (!IsEnd() && (in_->peek() == 't' || in_->peek() == 'f')) {
             char val = in_->peek();
             in_->unget();
@@ -126,4 +142,73 @@ Token Tokenizer::GetToken() {
     }
 
     return Token{SymbolToken{curr_symbol}};
+}
+
+Token Tokenizer::ReadString() {
+    size_t len = 1;
+    in_->get();
+
+    std::string value;
+    while (true) {
+        if (IsEnd()) {
+            throw SyntaxError{"unterminated string"};
+        }
+        char curr = in_->get();
+        len += 1;
+        if (curr == '"') {
+            break;
+        }
+        if (curr == '\\') {
+            if (IsEnd()) {
+                throw SyntaxError{"unterminated string"};
+            }
+            curr = in_->get();
+            len += 1;
+            if (curr == 'n') {
+                curr = '\n';
+            } else if (curr == 't') {
+                curr = '\t';
+            }
+        }
+        value.push_back(curr);
+    }
+
+    token_len_ = len;
+    while (len > 0) {
+        in_->unget();
+        len -= 1;
+    }
+    return Token{StringToken{std::move(value)}};
+}
+
+Token Tokenizer::ReadChar() {
+    in_->get();
+    in_->get();
+    if (IsEnd()) {
+        throw SyntaxError{"expected character after #\\"};
+    }
+
+    std::string name(1, in_->get());
+    while (std::isalpha(name.front()) && !IsEnd() && std::isalpha(in_->peek())) {
+        name.push_back(in_->get());
+    }
+
+    token_len_ = name.size() + 2;
+    for (size_t i = 0; i < token_len_; ++i) {
+        in_->unget();
+    }
+
+    if (name.size() == 1) {
+        return Token{CharToken{name.front()}};
+    }
+    if (name == "space") {
+        return Token{CharToken{' '}};
+    }
+    if (name == "newline") {
+        return Token{CharToken{'\n'}};
+    }
+    if (name == "tab") {
+        return Token{CharToken{'\t'}};
+    }
+    throw SyntaxError{"unknown character name: " + name};
 }
\ No newline at end of file
@@ -34,20 +34,55 @@ struct BooleanToken {
     bool operator==(const BooleanToken& other) const;
 };
 
-using Token =
-    std::variant<ConstantToken, BracketToken, SymbolToken, QuoteToken, DotToken, BooleanToken>;
+struct StringToken {
+    std::string value;
+
+    bool operator==(const StringToken& other) const;
+};
+
+struct CharToken {
+    char value;
+
+    bool operator==(const CharToken& other) const;
+};
+
+using Token = std::variant<ConstantToken, BracketToken, SymbolToken, QuoteToken, DotToken,
+                           BooleanToken, StringToken, CharToken>;
 
 class Tokenizer {
 public:
     Tokenizer(std::istream* in) : in_(in) {
         size_t len = 0;
+        bool in_string = false;
         while (!IsEnd()) {
             char curr = in_->get();
+            len += 1;
+
+            if (in_string || curr == '"') {
+                if (in_string && curr == '\\' && !IsEnd()) {
+                    in_->get();
+                    len += 1;
+                } else if (curr == '"') {
+                    in_string = !in_string;
+                }
+                continue;
+            }
+            if (curr == '#' && in_->peek() == '\\') {
+                in_->get();
+                len += 1;
+                if (!IsEnd()) {
+                    in_->get();
+                    len += 1;
+                }
+                continue;
+            }
             if (!AvailableChars(curr)) {
                 throw SyntaxError{"unavailable symbol: " + std::string(1, curr) +
                                   std::to_string(int(curr))};
             }
-            len += 1;
+        }
+        if (in_string) {
+            throw SyntaxError{"unterminated string"};
         }
         while (len > 0) {
             in_->unget();
@@ -64,6 +99,9 @@ public:
     Token GetToken();
 
 private:
+    Token ReadString();
+    Token ReadChar();
+
     void SkipSpaces() {
         while (!IsEnd() && std::isspace(in_->peek())) {
             in_->get();
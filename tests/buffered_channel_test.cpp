@@ -0,0 +1,88 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "thread_basics/buffered_channel.h"
+
+// Closes a BufferedChannel while senders and receivers are busy and checks that every Send that
+// returned normally is received exactly once, and that no Send succeeds after Close.
+
+namespace {
+constexpr int kRounds = 10000;
+constexpr int kSenders = 3;
+constexpr int kReceivers = 2;
+
+bool RunRound(int round) {
+    BufferedChannel<int> chan(4);
+    std::atomic<int64_t> sent_sum{0};
+    std::atomic<int> sent{0};
+    std::atomic<int64_t> received_sum{0};
+    std::atomic<int> received{0};
+    int sent_after_close = 0;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kSenders; ++i) {
+        threads.emplace_back([&, i] {
+            for (int value = i + 1;; value += kSenders) {
+                try {
+                    chan.Send(value);
+                } catch (const std::runtime_error&) {
+                    return;
+                }
+                sent_sum += value;
+                ++sent;
+            }
+        });
+    }
+    for (int i = 0; i < kReceivers; ++i) {
+        threads.emplace_back([&] {
+            while (auto value = chan.Recv()) {
+                received_sum += *value;
+                ++received;
+            }
+        });
+    }
+
+    for (int i = 0; i < round % 64; ++i) {
+        std::this_thread::yield();
+    }
+    chan.Close();
+    // Sends started after Close returned must throw.
+    try {
+        chan.Send(-1);
+        ++sent_after_close;
+    } catch (const std::runtime_error&) {
+    }
+    try {
+        chan.TrySend(-1);
+        ++sent_after_close;
+    } catch (const std::runtime_error&) {
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    if (sent.load() != received.load() || sent_sum.load() != received_sum.load() ||
+        sent_after_close != 0) {
+        std::cerr << "round " << round << ": sent " << sent.load() << ", received "
+                  << received.load() << ", sent after close " << sent_after_close
+                  << "\n";
+        return false;
+    }
+    return true;
+}
+}  // namespace
+
+int main() {
+    bool ok = true;
+    for (int round = 0; round < kRounds && ok; ++round) {
+        ok = RunRound(round);
+    }
+    std::cout << (ok ? "OK" : "FAILED") << "\n";
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,74 +1,384 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
-#include <utility>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <new>
 #include <optional>
-#include <deque>
-#include <condition_variable>
-#include <mutex>
+#include <span>
 #include <stdexcept>
-#include <iostream>
+#include <thread>
+#include <utility>
+
+#include "../lock_free/futex.h"
+#include "select.h"
 
+// Bounded channel on a lock-free ring (Vyukov's bounded MPMC queue).
+//
+// Position pos maps to slot pos % capacity on lap pos / capacity. Every slot has a turn number
+// that tells whose turn it is: a sender on lap l waits for turn == 2 * l, a receiver for
+// turn == 2 * l + 1. Positions only grow, so any capacity works. Threads sleep on an
+// EventCount only when the ring is full or empty, so the other side issues a wake syscall only
+// if somebody sleeps.
+//
+// Close sets the mark bit of tail, as crossbeam's array channel does: the CAS that claims slots
+// fails from then on, so every value is either claimed before Close and received, or not sent.
 template <class T>
 class BufferedChannel {
 public:
-    explicit BufferedChannel(size_t size) : size_(size) {
+    using Clock = std::chrono::steady_clock;
+
+    explicit BufferedChannel(size_t size)
+        : capacity_(std::max<size_t>(size, 1)), slots_(std::make_unique<Slot[]>(capacity_)) {
     }
 
-    void Send(const T& value) {
-        {
-            std::unique_lock lock(mtx_);
-            send_.wait(lock, [this] { return closed_.load() || buff_.size() < size_; });
+    BufferedChannel(const BufferedChannel&) = delete;
+    BufferedChannel& operator=(const BufferedChannel&) = delete;
 
-            if (closed_.load()) {
-                throw std::runtime_error("chan is closed");
+    ~BufferedChannel() {
+        auto head = head_.load(std::memory_order_relaxed);
+        auto tail = tail_.load(std::memory_order_relaxed) & ~kMarkBit;
+        for (; head != tail; ++head) {
+            if (auto& slot = slots_[head % capacity_]; !slot.dead) {
+                std::destroy_at(slot.Value());
             }
-
-            buff_.emplace_back(value);
         }
+    }
+
+    void Send(const T& value) {
+        SendImpl(1, [&]() -> const T& { return value; });
+    }
+
+    void Send(T&& value) {
+        SendImpl(1, [&]() -> T&& { return std::move(value); });
+    }
+
+    // Send that gives up after the timeout. Returns false if the value was not sent, the value
+    // is left untouched in that case.
+    template <class Rep, class Period>
+    bool SendFor(const T& value, const std::chrono::duration<Rep, Period>& timeout) {
+        return SendUntil(value, Clock::now() + std::chrono::ceil<Clock::duration>(timeout));
+    }
+
+    template <class Rep, class Period>
+    bool SendFor(T&& value, const std::chrono::duration<Rep, Period>& timeout) {
+        return SendUntil(std::move(value),
+                         Clock::now() + std::chrono::ceil<Clock::duration>(timeout));
+    }
+
+    bool SendUntil(const T& value, Clock::time_point deadline) {
+        return SendImpl(1, [&]() -> const T& { return value; }, deadline);
+    }
+
+    bool SendUntil(T&& value, Clock::time_point deadline) {
+        return SendImpl(1, [&]() -> T&& { return std::move(value); }, deadline);
+    }
+
+    // Moves all values into the channel, claiming as many free slots at once as possible.
+    // Throws if the channel gets closed in the middle; the values sent so far stay sent.
+    void SendMany(std::span<T> values) {
+        auto it = values.begin();
+        SendImpl(values.size(), [&]() -> T&& { return std::move(*it++); });
+    }
+
+    // Returns false instead of blocking if the channel is full. The value is left untouched
+    // in that case.
+    bool TrySend(const T& value) {
+        return TrySendImpl([&]() -> const T& { return value; });
+    }
 
-        recv_.notify_one();
+    bool TrySend(T&& value) {
+        return TrySendImpl([&]() -> T&& { return std::move(value); });
     }
 
+    // After Close returns the rest of the buffer, then std::nullopt.
     std::optional<T> Recv() {
         std::optional<T> ret;
-        {
-            std::unique_lock lock(mtx_);
+        RecvImpl(1, [&](T&& value) { ret.emplace(std::move(value)); });
+        return ret;
+    }
+
+    // Recv that gives up after the timeout. Returns std::nullopt on timeout, as well as after
+    // Close, use IsClosed to tell them apart.
+    template <class Rep, class Period>
+    std::optional<T> RecvFor(const std::chrono::duration<Rep, Period>& timeout) {
+        return RecvUntil(Clock::now() + std::chrono::ceil<Clock::duration>(timeout));
+    }
+
+    std::optional<T> RecvUntil(Clock::time_point deadline) {
+        std::optional<T> ret;
+        RecvImpl(1, [&](T&& value) { ret.emplace(std::move(value)); }, deadline);
+        return ret;
+    }
+
+    // Blocks until there is at least one value and moves up to max of them to out. Returns the
+    // number of values received, 0 only after Close or if max is 0. If writing to out throws,
+    // the values received in the same call after the failed one are dropped.
+    template <class OutputIt>
+    size_t RecvMany(OutputIt out, size_t max) {
+        if (max == 0) {
+            return 0;
+        }
+        return RecvImpl(max, [&](T&& value) { *out++ = std::move(value); });
+    }
+
+    // Returns std::nullopt instead of blocking if the channel is empty.
+    std::optional<T> TryRecv() {
+        std::optional<T> ret;
+        if (PopMany(1, [&](T&& value) { ret.emplace(std::move(value)); })) {
+            NotifySenders();
+        }
+        return ret;
+    }
+
+    void Close() {
+        tail_.fetch_or(kMarkBit);
+        NotifySenders();
+        NotifyReceivers();
+    }
+
+    bool IsClosed() const {
+        return tail_.load() & kMarkBit;
+    }
+
+    // Used by Select.
+    SelectWaiters& Waiters() {
+        return select_waiters_;
+    }
 
-            recv_.wait(lock, [this] { return closed_.load() || !buff_.empty(); });
+private:
+    inline static constexpr size_t kMarkBit = ~(SIZE_MAX >> 1);
+
+    struct Slot {
+        std::atomic<size_t> turn{};
+        // Set instead of a value if the sender threw after claiming the slot.
+        bool dead = false;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T* Value() {
+            return std::launder(reinterpret_cast<T*>(storage));
+        }
+    };
+
+    // next() yields the values to send one by one. Returns false if the deadline passed first.
+    template <class F>
+    bool SendImpl(size_t count, F next, std::optional<Clock::time_point> deadline = {}) {
+        auto blocked = [this] { return !IsClosed() && Full(); };
+        while (count > 0) {
+            if (auto pushed = PushMany(count, next)) {
+                count -= pushed;
+                NotifyReceivers();
+                continue;
+            }
+            if (IsClosed()) {
+                throw std::runtime_error("chan is closed");
+            }
+            if (!deadline) {
+                not_full_.Wait(blocked);
+            } else if (!not_full_.WaitUntil(blocked, *deadline)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <class F>
+    bool TrySendImpl(F next) {
+        if (!PushMany(1, next)) {
+            if (IsClosed()) {
+                throw std::runtime_error("chan is closed");
+            }
+            return false;
+        }
+        NotifyReceivers();
+        return true;
+    }
+
+    template <class F>
+    size_t RecvImpl(size_t max, F consume, std::optional<Clock::time_point> deadline = {}) {
+        auto blocked = [this] { return !IsClosed() && Empty(); };
+        while (true) {
+            if (auto popped = PopMany(max, consume)) {
+                NotifySenders();
+                return popped;
+            }
+            if (auto tail = tail_.load(); tail & kMarkBit) {
+                // Tail does not move after Close, but a sender that claimed slots before it may
+                // still be writing them.
+                if ((tail & ~kMarkBit) == head_.load()) {
+                    return 0;
+                }
+                std::this_thread::yield();
+                continue;
+            }
+            if (!deadline) {
+                not_empty_.Wait(blocked);
+            } else if (!not_empty_.WaitUntil(blocked, *deadline)) {
+                return 0;
+            }
+        }
+    }
+
+    // Claims up to max consecutive free slots with one CAS and fills them with next(). Returns 0
+    // if the channel is full or closed.
+    template <class F>
+    size_t PushMany(size_t max, F&& next) {
+        auto pos = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            if (pos & kMarkBit) {
+                return 0;
+            }
+            size_t index = pos % capacity_;
+            size_t lap = pos / capacity_;
+            auto count = CountTurns(index, 2 * lap, max);
+            if (count == 0) {
+                if (slots_[index].turn.load(std::memory_order_acquire) < 2 * lap) {
+                    return 0;
+                }
+                pos = tail_.load(std::memory_order_relaxed);
+                continue;
+            }
 
-            if (closed_.load()) {
-                if (buff_.empty()) {
-                    return std::nullopt;
+            // Nobody else can fill or free the slots we saw free until tail passes them. Fails
+            // once Close has marked tail.
+            if (tail_.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+                size_t i = 0;
+                try {
+                    for (; i < count; ++i) {
+                        auto& slot = slots_[index];
+                        std::construct_at(slot.Value(), next());
+                        slot.turn.store(2 * lap + 1, std::memory_order_release);
+                        Advance(&index, &lap);
+                    }
+                } catch (...) {
+                    // The slots are claimed already, hand the rest to receivers as dead ones.
+                    for (; i < count; ++i) {
+                        auto& slot = slots_[index];
+                        slot.dead = true;
+                        slot.turn.store(2 * lap + 1, std::memory_order_release);
+                        Advance(&index, &lap);
+                    }
+                    NotifyReceivers();
+                    throw;
                 }
+                return count;
+            }
+        }
+    }
 
-                ret.emplace(uff_.front());
-                buff_.pop_front();
+    // Claims up to max consecutive full slots with one CAS and passes the values to consume.
+    // Dead slots are freed without a value; if all of them were dead, tries again.
+    template <class F>
+    size_t PopMany(size_t max, F&& consume) {
+        if (max == 0) {
+            return 0;
+        }
+        auto pos = head_.load(std::memory_order_relaxed);
+        while (true) {
+            size_t index = pos % capacity_;
+            size_t lap = pos / capacity_;
+            auto count = CountTurns(index, 2 * lap + 1, max);
+            if (count == 0) {
+                if (slots_[index].turn.load(std::memory_order_acquire) < 2 * lap + 1) {
+                    return 0;
+                }
+                pos = head_.load(std::memory_order_relaxed);
+                continue;
+            }
 
-                return ret;
+            if (head_.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+                size_t popped = 0;
+                size_t i = 0;
+                try {
+                    for (; i < count; ++i) {
+                        auto& slot = slots_[index];
+                        if (slot.dead) {
+                            slot.dead = false;
+                        } else {
+                            consume(std::move(*slot.Value()));
+                            std::destroy_at(slot.Value());
+                            ++popped;
+                        }
+                        slot.turn.store(2 * lap + 2, std::memory_order_release);
+                        Advance(&index, &lap);
+                    }
+                } catch (...) {
+                    // Head has passed the slots already, so they can only be freed: the value
+                    // consume threw on and the ones claimed after it are dropped.
+                    for (; i < count; ++i) {
+                        auto& slot = slots_[index];
+                        if (slot.dead) {
+                            slot.dead = false;
+                        } else {
+                            std::destroy_at(slot.Value());
+                        }
+                        slot.turn.store(2 * lap + 2, std::memory_order_release);
+                        Advance(&index, &lap);
+                    }
+                    NotifySenders();
+                    throw;
+                }
+                if (popped > 0) {
+                    return popped;
+                }
+                NotifySenders();
+                pos = head_.load(std::memory_order_relaxed);
             }
+        }
+    }
+
+    // One fence covers both kinds of waiters.
+    void NotifySenders() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        not_full_.NotifyAllFenced();
+        select_waiters_.NotifyAllFenced();
+    }
 
-            ret.emplace(buff_.front());
-            buff_.pop_front();
+    void NotifyReceivers() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        not_empty_.NotifyAllFenced();
+        select_waiters_.NotifyAllFenced();
+    }
+
+    // Number of consecutive slots from index on, up to max, that are at the given turn. Slots past
+    // the end of the array are on the next lap, i.e. two turns later.
+    size_t CountTurns(size_t index, size_t turn, size_t max) const {
+        size_t count = 0;
+        while (count < max && slots_[index].turn.load(std::memory_order_acquire) == turn) {
+            ++count;
+            if (++index == capacity_) {
+                index = 0;
+                turn += 2;
+            }
         }
+        return count;
+    }
 
-        send_.notify_one();
+    void Advance(size_t* index, size_t* lap) const {
+        if (++*index == capacity_) {
+            *index = 0;
+            ++*lap;
+        }
+    }
 
-        return ret;
+    bool Full() const {
+        auto pos = tail_.load(std::memory_order_relaxed) & ~kMarkBit;
+        return slots_[pos % capacity_].turn.load(std::memory_order_acquire) < 2 * (pos / capacity_);
     }
 
-    void Close() {
-        closed_.store(true);
-        send_.notify_all();
-        recv_.notify_all();
+    bool Empty() const {
+        auto pos = head_.load(std::memory_order_relaxed);
+        return slots_[pos % capacity_].turn.load(std::memory_order_acquire) <
+               2 * (pos / capacity_) + 1;
     }
 
-private:
-    size_t size_;
-    std::mutex mtx_;
-    std::condition_variable send_;
-    std::condition_variable recv_;
-    std::deque<T> buff_;
-    std::atomic_bool closed_{};
+    const size_t capacity_;
+    std::unique_ptr<Slot[]> slots_;
+    alignas(64) std::atomic<size_t> head_{};
+    alignas(64) std::atomic<size_t> tail_{};
+    alignas(64) EventCount not_full_;
+    alignas(64) EventCount not_empty_;
+    SelectWaiters select_waiters_;
 };
-b
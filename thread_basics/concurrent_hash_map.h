@@ -1,111 +1,312 @@
 #pragma once
 
 #include <vector>
-#include <list>
+#include <utility>
+#include <algorithm>
+#include <span>
 #include <memory>
 #include <mutex>
 #include <functional>
 #include <atomic>
+#include <cstdlib>
+#include <new>
+#include <exception>
 #include <stdexcept>
+#include <thread>
 #include <iostream>
 
-template <class K, class V, class Hash = std::hash<K>>
+#include "../lock_free/epoch.h"
+
+// Writers take the stripe lock of the key, readers take no locks: bucket chains are atomic
+// and unlinked nodes (and replaced tables) are reclaimed through epochs. Since readers may
+// be copying a value at any time, values are never modified in place: updates link a new
+// node instead of the old one.
+//
+// Resizing is incremental: the new table is attached to the old one, and every Insert/Erase
+// migrates a few buckets (plus the bucket of its own key) until the old table is empty.
+// Migrated buckets are marked, so readers know to look into the new table.
+//
+// If both Hash and KeyEqual define is_transparent, Find, FindAndVisit, At and Erase accept
+// any key type they support, e.g. std::string_view for std::string keys.
+template <class K, class V, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>>
 class ConcurrentHashMap {
+    inline static constexpr bool kTransparent = requires {
+        typename Hash::is_transparent;
+        typename KeyEqual::is_transparent;
+    };
+
+    template <bool transparent, class = void>
+    struct KeyArgImpl {
+        template <class Q>
+        using Type = K;
+    };
+    template <class Dummy>
+    struct KeyArgImpl<true, Dummy> {
+        template <class Q>
+        using Type = Q;
+    };
+
+    // Q for transparent maps, K otherwise. Q is still deduced in the transparent case.
+    template <class Q>
+    using KeyArg = typename KeyArgImpl<kTransparent>::template Type<Q>;
+
 public:
     inline static constexpr int kLoadFactor = 2;
     inline static constexpr int kDefaultConcurrencyLevel = 32;
     inline static constexpr int kUndefinedSize = 64;
+    inline static constexpr size_t kMigrationChunk = 8;
+    inline static constexpr size_t kPrefetchDistance = 8;
 
     ConcurrentHashMap(const Hash& hasher = Hash()) : ConcurrentHashMap(kUndefinedSize, hasher) {
     }
 
     explicit ConcurrentHashMap(int expected_size, const Hash& hasher = Hash())
-        : ConcurrentHashMap(expected_size, kDefaultConcurrencyLevel, hasher) {
+        : ConcurrentHashMap(expected_size, DefaultThreadsCount(), hasher) {
     }
 
-    ConcurrentHashMap(int expected_size, int expected_threads_count, const Hash& hasher = Hash())
-        : hasher_(hasher) {
+    // Uses 4 stripes per expected writer thread.
+    ConcurrentHashMap(int expected_size, int expected_threads_count, const Hash& hasher = Hash(),
+                      const KeyEqual& key_equal = KeyEqual())
+        : hasher_(hasher), key_equal_(key_equal) {
         size_.store(0u);
-        expected_threads_count = std::min(4, expected_threads_count);
+        expected_threads_count = std::max(1, expected_threads_count);
 
         concure_level_ = expected_threads_count * 4;
+        stripes_ = std::make_unique<Stripe[]>(concure_level_);
 
+        size_t cap;
         if (expected_size <= concure_level_ * kLoadFactor) {
-            cap_ = concure_level_ * kLoadFactor;
+            cap = concure_level_ * kLoadFactor;
         } else {
-            cap_ = (expected_size / concure_level_ + 1) * concure_level_ * kLoadFactor;
+            cap = (expected_size / concure_level_ + 1) * concure_level_ * kLoadFactor;
         }
 
-        data_.resize(cap_);
+        table_.store(new Table(cap));
+    }
+
+    ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+    ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+    ~ConcurrentHashMap() {
+        auto table = table_.load();
+        delete table->next.load();
+        delete table;
     }
 
     bool Insert(const K& key, const V& value) {
-        Rehash();
+        return Emplace(key, value);
+    }
 
-        auto hash = hasher_(key);
-        std::lock_guard lock(mutexes_[hash % concure_level_]);
-        hash %= cap_;
+    bool Insert(K&& key, V&& value) {
+        return Emplace(std::move(key), std::move(value));
+    }
 
-        if (auto it = std::find_if(data_[hash].begin(), data_[hash].end(),
-                                   [key](const auto& p) { return p.first == key; });
-            it != data_[hash].end()) {
-            return false;
-        }
+    // Constructs the value from args if the key is absent. Returns true if it was inserted.
+    template <class... Args>
+    bool Emplace(const K& key, Args&&... args) {
+        return EmplaceImpl(key, std::forward<Args>(args)...);
+    }
 
-        size_.fetch_add(1);
-        data_[hash].emplace_back(key, value);
+    template <class... Args>
+    bool Emplace(K&& key, Args&&... args) {
+        return EmplaceImpl(std::move(key), std::forward<Args>(args)...);
+    }
 
-        return true;
+    // Returns true if the key was inserted, false if its value was replaced.
+    bool InsertOrAssign(const K& key, const V& value) {
+        return WithLink(key, [&](Node** link) {
+            if (Ref(*link).load(std::memory_order_relaxed)) {
+                Replace(link, value);
+                return false;
+            }
+            Append(link, key, value);
+            return true;
+        });
     }
 
-    bool Erase(const K& key) {
-        auto hash = hasher_(key);
-        std::lock_guard lock(mutexes_[hash % concure_level_]);
-        hash %= cap_;
+    // Applies fn(V&) to the value of the key, or to V() which is then inserted. Returns true
+    // if the key was inserted.
+    template <class F>
+    bool Upsert(const K& key, F fn) {
+        return WithLink(key, [&](Node** link) {
+            auto node = Ref(*link).load(std::memory_order_relaxed);
+            V value = node ? node->value : V();
+            fn(value);
+            if (node) {
+                Replace(link, std::move(value));
+                return false;
+            }
+            Append(link, key, std::move(value));
+            return true;
+        });
+    }
 
-        auto it = std::find_if(data_[hash].begin(), data_[hash].end(),
-                               [key](const auto& p) { return p.first == key; });
+    // Returns the value of the key, inserting factory() first if there is none.
+    template <class F>
+    V ComputeIfAbsent(const K& key, F factory) {
+        return WithLink(key, [&](Node** link) {
+            if (auto node = Ref(*link).load(std::memory_order_relaxed)) {
+                return node->value;
+            }
+            V value = factory();
+            Append(link, key, value);
+            return value;
+        });
+    }
+
+    // Applies fn(V&) to the value of the key. Returns false if there is no such key.
+    template <class F>
+    bool Update(const K& key, F fn) {
+        return WithLink(key, [&](Node** link) {
+            auto node = Ref(*link).load(std::memory_order_relaxed);
+            if (!node) {
+                return false;
+            }
+            V value = node->value;
+            fn(value);
+            Replace(link, std::move(value));
+            return true;
+        });
+    }
+
+    // Inserts every pair whose key is absent. Keys are grouped by stripe, so every stripe
+    // lock is taken once per batch. Returns the number of inserted pairs.
+    size_t InsertMany(std::span<const std::pair<K, V>> items) {
+        std::vector<std::pair<size_t, size_t>> order(items.size());
+        for (size_t i = 0; i < items.size(); ++i) {
+            order[i] = {hasher_(items[i].first), i};
+        }
+        // Keeps the batch order within a stripe, so the first of equal keys wins.
+        std::stable_sort(order.begin(), order.end(), [this](const auto& lhs, const auto& rhs) {
+            return lhs.first % concure_level_ < rhs.first % concure_level_;
+        });
+
+        size_t inserted = 0;
+        EpochGuard guard;
+        for (size_t begin = 0, end; begin < order.size(); begin = end) {
+            auto stripe = order[begin].first % concure_level_;
+            end = begin;
+            while (end < order.size() && order[end].first % concure_level_ == stripe) {
+                ++end;
+            }
+
+            Grow();
+            std::lock_guard lock(StripeLock(stripe));
+            for (size_t i = begin; i < end; ++i) {
+                auto [hash, idx] = order[i];
+                if (i + kPrefetchDistance < end) {
+                    auto table = table_.load(std::memory_order_relaxed);
+                    __builtin_prefetch(&table->buckets[order[i + kPrefetchDistance].first %
+                                                       table->cap]);
+                }
 
-        if (it == data_[hash].end()) {
-            return false;
+                auto link = FindLink(WritableTable(hash), hash, items[idx].first);
+                if (!Ref(*link).load(std::memory_order_relaxed)) {
+                    Append(link, items[idx].first, items[idx].second);
+                    inserted += 1;
+                }
+            }
         }
+        return inserted;
+    }
 
-        size_.fetch_sub(1);
-        data_[hash].erase(it);
-        return true;
+    template <class Q = K>
+    bool Erase(const KeyArg<Q>& key) {
+        return WithLink(key, [&](Node** link) {
+            auto node = Ref(*link).load(std::memory_order_relaxed);
+            if (!node) {
+                return false;
+            }
+
+            size_.fetch_sub(1);
+            // Readers standing on the node can still follow its next pointer.
+            Ref(*link).store(node->next, std::memory_order_release);
+            EpochManager::Instance().Retire(node);
+            return true;
+        });
     }
 
     void Clear() {
-        for (int i = 0; i < concure_level_; ++i) {
-            mutexes_[i].lock();
-        }
+        // Allocated before the stripes are locked, so bad_alloc leaves them unlocked.
+        auto table = new Table(concure_level_ * kLoadFactor * kLoadFactor);
+        std::lock_guard resize_lock(resize_mutex_);
+        LockAll();
 
         size_.store(0);
-        cap_ = concure_level_ * kLoadFactor * kLoadFactor;
-        data_.clear();
-        data_.resize(cap_);
+        auto old = table_.exchange(table, std::memory_order_acq_rel);
+        if (auto next = old->next.load()) {
+            EpochManager::Instance().Retire(next);
+        }
+        EpochManager::Instance().Retire(old);
 
-        for (int i = concure_level_ - 1; i >= 0; --i) {
-            mutexes_[i].unlock();
+        UnlockAll();
+    }
+
+    template <class Q = K>
+    std::pair<bool, V> Find(const KeyArg<Q>& key) const {
+        auto hash = hasher_(key);
+        EpochGuard guard;
+
+        if (auto node = Lookup(table_.load(std::memory_order_acquire), hash, key)) {
+            return {true, node->value};
         }
+        return {false, V()};
     }
 
-    std::pair<bool, V> Find(const K& key) const {
+    // Calls fn(const V&) on the stored value without copying it. Writers never modify stored
+    // values, but fn runs concurrently with them, and the reference is valid only inside fn.
+    // Returns false if there is no such key.
+    template <class F, class Q = K>
+    bool FindAndVisit(const KeyArg<Q>& key, F fn) const {
         auto hash = hasher_(key);
-        std::lock_guard lock(mutexes_[hash % concure_level_]);
-        hash %= cap_;
+        EpochGuard guard;
 
-        auto it = std::find_if(data_[hash].begin(), data_[hash].end(),
-                               [key](const auto& p) { return p.first == key; });
+        if (auto node = Lookup(table_.load(std::memory_order_acquire), hash, key)) {
+            fn(node->value);
+            return true;
+        }
+        return false;
+    }
 
-        if (it == data_[hash].end()) {
-            return {false, V()};
+    // Finds every key, out[i] is the result for keys[i]. Returns the number of found keys.
+    //
+    // Bucket heads and first nodes are prefetched a few keys ahead, so cache misses of
+    // different keys overlap.
+    size_t FindMany(std::span<const K> keys, std::span<std::pair<bool, V>> out) const {
+        std::vector<size_t> hashes(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            hashes[i] = hasher_(keys[i]);
         }
-        return {true, it->second};
+
+        EpochGuard guard;
+        auto table = table_.load(std::memory_order_acquire);
+        for (size_t i = 0; i < std::min(keys.size(), kPrefetchDistance); ++i) {
+            __builtin_prefetch(&table->buckets[hashes[i] % table->cap]);
+        }
+
+        size_t found = 0;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (i + kPrefetchDistance < keys.size()) {
+                __builtin_prefetch(&table->buckets[hashes[i + kPrefetchDistance] % table->cap]);
+            }
+            if (i + kPrefetchDistance / 2 < keys.size()) {
+                auto& bucket = table->buckets[hashes[i + kPrefetchDistance / 2] % table->cap];
+                __builtin_prefetch(Ref(bucket).load(std::memory_order_relaxed));
+            }
+
+            if (auto node = Lookup(table, hashes[i], keys[i])) {
+                out[i] = {true, node->value};
+                found += 1;
+            } else {
+                out[i] = {false, V()};
+            }
+        }
+        return found;
     }
 
-    const V At(const K& key) const {
-        auto [has, value] = Find(key);
+    template <class Q = K>
+    const V At(const KeyArg<Q>& key) const {
+        auto [has, value] = Find<Q>(key);
 
         if (!has) {
             throw std::out_of_range{"no such key"};
@@ -117,35 +318,358 @@ public:
         return size_.load();
     }
 
-private:
-    void Rehash() {
-        if (size_.load() * 4 > cap_) {
-            for (int i = 0; i < concure_level_; ++i) {
-                mutexes_[i].lock();
+    // Calls fn(key, value) for every entry, one stripe at a time under its lock: fn must not
+    // modify the map.
+    template <class F>
+    void ForEach(F fn) const {
+        for (int stripe = 0; stripe < concure_level_; ++stripe) {
+            EpochGuard guard;
+            std::lock_guard lock(stripes_[stripe].mutex);
+            VisitStripe(stripe, fn);
+        }
+    }
+
+    // Same as ForEach, but stripes are distributed between threads_count threads (including
+    // the calling one), so fn must be thread-safe.
+    // The first exception thrown by fn stops the other threads and is rethrown.
+    template <class F>
+    void ParallelForEach(F fn, size_t threads_count) const {
+        std::atomic<int> next_stripe{};
+        std::mutex error_mutex;
+        std::exception_ptr error;
+        auto worker = [&] {
+            try {
+                for (int stripe; (stripe = next_stripe.fetch_add(1)) < concure_level_;) {
+                    EpochGuard guard;
+                    std::lock_guard lock(stripes_[stripe].mutex);
+                    VisitStripe(stripe, fn);
+                }
+            } catch (...) {
+                std::lock_guard lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next_stripe.store(concure_level_);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        auto join = [&] {
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        };
+        try {
+            for (size_t i = 1; i < threads_count; ++i) {
+                threads.emplace_back(worker);
+            }
+        } catch (...) {
+            next_stripe.store(concure_level_);
+            join();
+            throw;
+        }
+        worker();
+        join();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Point-in-time copy of the map. All stripes are locked at once, and each one is
+    // released as soon as it is copied, so writers wait only for their own stripe.
+    std::vector<std::pair<K, V>> Snapshot() const {
+        std::vector<std::pair<K, V>> entries;
+        entries.reserve(size_.load());
+
+        auto copy = [&entries](const K& key, const V& value) { entries.emplace_back(key, value); };
+        // A throwing copy releases the stripes not copied yet.
+        std::vector<std::unique_lock<std::mutex>> locks;
+        locks.reserve(concure_level_);
+        for (int stripe = 0; stripe < concure_level_; ++stripe) {
+            locks.emplace_back(stripes_[stripe].mutex);
+        }
+        for (int stripe = 0; stripe < concure_level_; ++stripe) {
+            {
+                EpochGuard guard;
+                VisitStripe(stripe, copy);
             }
+            locks[stripe].unlock();
+        }
+        return entries;
+    }
+
+private:
+    // Links are plain pointers accessed through std::atomic_ref, so bucket arrays can come
+    // zeroed from calloc without touching every page up front.
+    struct alignas(64) Stripe {
+        std::mutex mutex;
+    };
+
+    struct Node {
+        const K key;
+        const V value;
+        Node* next;
+    };
+
+    inline static Node* const kMoved = reinterpret_cast<Node*>(alignof(Node));
 
-            size_t new_cap = cap_ * kLoadFactor;
-            std::vector<std::list<std::pair<K, V>>> new_data(new_cap);
-            for (size_t i = 0; i < cap_; ++i) {
-                for (const auto& [key, value] : data_[i]) {
-                    auto hash = hasher_(key) % new_cap;
+    // Owns the nodes linked into its buckets, but not the next table.
+    struct Table {
+        explicit Table(size_t cap)
+            : cap(cap), buckets(static_cast<Node**>(std::calloc(cap, sizeof(Node*)))) {
+            if (!buckets) {
+                throw std::bad_alloc();
+            }
+        }
 
-                    new_data[hash].emplace_back(key, value);
+        ~Table() {
+            // Fully migrated tables have nothing to free, and scanning them would take long.
+            for (size_t i = 0; i < cap && migrated.load() < cap; ++i) {
+                if (buckets[i] != kMoved) {
+                    DeleteChain(buckets[i]);
                 }
             }
+            std::free(buckets);
+        }
+
+        const size_t cap;
+        Node** const buckets;
+        std::atomic<Table*> next{};
+        // Next bucket to be claimed by a helper and the number of migrated buckets.
+        std::atomic<size_t> cursor{};
+        std::atomic<size_t> migrated{};
+        // Claimed ranges whose migration was interrupted by an exception, to be claimed again.
+        std::mutex failed_mutex;
+        std::vector<std::pair<size_t, size_t>> failed;
+        std::atomic_bool has_failed{};
+    };
+
+    static std::atomic_ref<Node*> Ref(Node*& link) {
+        return std::atomic_ref<Node*>(link);
+    }
+
+    static void DeleteChain(void* head) {
+        auto node = static_cast<Node*>(head);
+        while (node) {
+            delete std::exchange(node, node->next);
+        }
+    }
+
+    static int DefaultThreadsCount() {
+        auto threads_count = static_cast<int>(std::thread::hardware_concurrency());
+        return threads_count > 0 ? threads_count : kDefaultConcurrencyLevel;
+    }
+
+    std::mutex& StripeLock(size_t hash) const {
+        return stripes_[hash % concure_level_].mutex;
+    }
+
+    void LockAll() const {
+        for (int i = 0; i < concure_level_; ++i) {
+            stripes_[i].mutex.lock();
+        }
+    }
+
+    void UnlockAll() const {
+        for (int i = concure_level_ - 1; i >= 0; --i) {
+            stripes_[i].mutex.unlock();
+        }
+    }
+
+    // Starts a resize when the table is overloaded and helps to finish the one in progress.
+    // Must be called inside an epoch guard.
+    void Grow() {
+        auto table = table_.load(std::memory_order_acquire);
+        if (!table->next.load(std::memory_order_acquire)) {
+            if (size_.load() * 4 <= table->cap) {
+                return;
+            }
+
+            std::unique_lock lock(resize_mutex_, std::try_to_lock);
+            if (!lock.owns_lock() || table_.load() != table || table->next.load()) {
+                return;
+            }
+            table->next.store(new Table(table->cap * kLoadFactor), std::memory_order_release);
+        }
+
+        auto [begin, end] = ClaimRange(table);
+        for (size_t bucket = begin; bucket < end; ++bucket) {
+            try {
+                std::lock_guard lock(StripeLock(bucket));
+                MigrateBucket(table, bucket);
+            } catch (...) {
+                // Otherwise the rest of the range would never be migrated.
+                std::lock_guard lock(table->failed_mutex);
+                table->failed.emplace_back(bucket, end);
+                table->has_failed.store(true);
+                throw;
+            }
+        }
+    }
+
+    // Buckets [first, second) to migrate; an empty range once every bucket is claimed.
+    static std::pair<size_t, size_t> ClaimRange(Table* table) {
+        if (table->has_failed.load()) {
+            std::lock_guard lock(table->failed_mutex);
+            if (!table->failed.empty()) {
+                auto range = table->failed.back();
+                table->failed.pop_back();
+                table->has_failed.store(!table->failed.empty());
+                return range;
+            }
+        }
+        size_t begin = std::min(table->cursor.fetch_add(kMigrationChunk), table->cap);
+        return {begin, std::min(begin + kMigrationChunk, table->cap)};
+    }
+
+    // Hashes the key once, takes its stripe lock and calls fn with the key's link.
+    template <class Q, class F>
+    auto WithLink(const Q& key, F fn) {
+        auto hash = hasher_(key);
+        EpochGuard guard;
+        Grow();
+
+        std::lock_guard lock(StripeLock(hash));
+        return fn(FindLink(WritableTable(hash), hash, key));
+    }
+
+    // Link that points to the key's node, or to the end of its chain if there is no such key.
+    // The caller holds the key's stripe lock.
+    template <class Q>
+    Node** FindLink(Table* table, size_t hash, const Q& key) {
+        auto link = &table->buckets[hash % table->cap];
+        for (auto node = Ref(*link).load(std::memory_order_relaxed);
+             node && !key_equal_(node->key, key);
+             node = Ref(*link).load(std::memory_order_relaxed)) {
+            link = &node->next;
+        }
+        return link;
+    }
+
+    // Calls fn(key, value) for every entry of the stripe. The caller holds the stripe lock and
+    // an epoch guard.
+    template <class F>
+    void VisitStripe(size_t stripe, F& fn) const {
+        auto table = table_.load(std::memory_order_acquire);
+        auto next = table->next.load(std::memory_order_acquire);
+        for (size_t idx = stripe; idx < table->cap; idx += concure_level_) {
+            auto node = Ref(table->buckets[idx]).load(std::memory_order_relaxed);
+            if (node != kMoved) {
+                VisitChain(node, fn);
+                continue;
+            }
+            // A migrated bucket is split into buckets idx, idx + cap, ... of the next table.
+            for (size_t next_idx = idx; next_idx < next->cap; next_idx += table->cap) {
+                VisitChain(Ref(next->buckets[next_idx]).load(std::memory_order_relaxed), fn);
+            }
+        }
+    }
+
+    template <class F>
+    static void VisitChain(const Node* node, F& fn) {
+        for (; node; node = node->next) {
+            fn(node->key, node->value);
+        }
+    }
+
+    // Must be called inside an epoch guard.
+    template <class Q>
+    const Node* Lookup(Table* table, size_t hash, const Q& key) const {
+        auto node = Ref(table->buckets[hash % table->cap]).load(std::memory_order_acquire);
+        while (node == kMoved) {
+            table = table->next.load(std::memory_order_acquire);
+            node = Ref(table->buckets[hash % table->cap]).load(std::memory_order_acquire);
+        }
+
+        for (; node; node = Ref(node->next).load(std::memory_order_acquire)) {
+            if (key_equal_(node->key, key)) {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
+    template <class KeyType, class... Args>
+    bool EmplaceImpl(KeyType&& key, Args&&... args) {
+        return WithLink(key, [&](Node** link) {
+            if (Ref(*link).load(std::memory_order_relaxed)) {
+                return false;
+            }
+            Append(link, std::forward<KeyType>(key), std::forward<Args>(args)...);
+            return true;
+        });
+    }
+
+    template <class KeyType, class... Args>
+    void Append(Node** link, KeyType&& key, Args&&... args) {
+        Ref(*link).store(new Node{std::forward<KeyType>(key), V(std::forward<Args>(args)...),
+                                  nullptr},
+                         std::memory_order_release);
+        size_.fetch_add(1);
+    }
+
+    void Replace(Node** link, V value) {
+        auto old = *link;
+        Ref(*link).store(new Node{old->key, std::move(value), old->next},
+                         std::memory_order_release);
+        EpochManager::Instance().Retire(old);
+    }
+
+    // Table to modify for the key. The caller holds the key's stripe lock, which also guards
+    // every bucket the key may be in: capacities are multiples of the stripe count.
+    Table* WritableTable(size_t hash) {
+        auto table = table_.load(std::memory_order_acquire);
+        while (auto next = table->next.load(std::memory_order_acquire)) {
+            MigrateBucket(table, hash % table->cap);
+            table = next;
+        }
+        return table;
+    }
+
+    // Copies the bucket into the next table; nodes are not relinked, since readers may still
+    // walk the old chain. All copies are made before any is linked, so a throwing copy leaves
+    // the bucket unmigrated rather than half-copied. The caller holds the bucket's stripe lock.
+    void MigrateBucket(Table* table, size_t idx) {
+        auto head = Ref(table->buckets[idx]).load(std::memory_order_relaxed);
+        if (head == kMoved) {
+            return;
+        }
+
+        Node* copies = nullptr;
+        try {
+            for (auto node = head; node; node = node->next) {
+                copies = new Node{node->key, node->value, copies};
+            }
+        } catch (...) {
+            DeleteChain(copies);
+            throw;
+        }
+
+        auto next = table->next.load(std::memory_order_acquire);
+        while (copies) {
+            auto node = std::exchange(copies, copies->next);
+            auto& bucket = next->buckets[hasher_(node->key) % next->cap];
+            node->next = Ref(bucket).load(std::memory_order_relaxed);
+            Ref(bucket).store(node, std::memory_order_release);
+        }
+        Ref(table->buckets[idx]).store(kMoved, std::memory_order_release);
+        if (head) {
+            EpochManager::Instance().Retire(head, DeleteChain);
+        }
 
-            cap_ = new_cap;
-            data_.swap(new_data);
-            for (int i = concure_level_ - 1; i >= 0; --i) {
-                mutexes_[i].unlock();
+        if (table->migrated.fetch_add(1) + 1 == table->cap) {
+            // Fails if Clear has already replaced (and retired) the table.
+            if (table_.compare_exchange_strong(table, next)) {
+                EpochManager::Instance().Retire(table);
             }
         }
     }
 
     Hash hasher_;
-    std::atomic<size_t> cap_{};
+    KeyEqual key_equal_;
+    std::atomic<Table*> table_{};
     int concure_level_{};
     std::atomic<size_t> size_{};
-    std::vector<std::list<std::pair<K, V>>> data_;
-    mutable std::mutex mutexes_[kDefaultConcurrencyLevel];
+    std::mutex resize_mutex_;
+    std::unique_ptr<Stripe[]> stripes_;
 };
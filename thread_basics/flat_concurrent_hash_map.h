@@ -0,0 +1,334 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Concurrent hash map with the same interface as ConcurrentHashMap, but every shard is one
+// open-addressing table: key/value pairs are stored inline in a flat array, and a probe scans
+// 16 one-byte tags (7 bits of the hash) at once before touching any slot.
+template <class K, class V, class Hash = std::hash<K>>
+class FlatConcurrentHashMap {
+public:
+    inline static constexpr int kDefaultConcurrencyLevel = 32;
+    inline static constexpr int kUndefinedSize = 64;
+
+    FlatConcurrentHashMap(const Hash& hasher = Hash())
+        : FlatConcurrentHashMap(kUndefinedSize, hasher) {
+    }
+
+    explicit FlatConcurrentHashMap(int expected_size, const Hash& hasher = Hash())
+        : FlatConcurrentHashMap(expected_size, kDefaultConcurrencyLevel, hasher) {
+    }
+
+    FlatConcurrentHashMap(int expected_size, int expected_threads_count,
+                          const Hash& hasher = Hash())
+        : hasher_(hasher) {
+        size_t shards = std::bit_ceil(static_cast<size_t>(std::max(1, expected_threads_count)) * 4);
+        shard_shift_ = 64 - std::countr_zero(shards);
+        shards_ = std::make_unique<Shard[]>(shards);
+        shards_count_ = shards;
+
+        size_t per_shard = static_cast<size_t>(std::max(expected_size, 0)) / shards + 1;
+        for (size_t i = 0; i < shards; ++i) {
+            shards_[i].table.Reserve(per_shard, *this);
+        }
+    }
+
+    bool Insert(const K& key, const V& value) {
+        auto hash = HashOf(key);
+        auto& shard = GetShard(hash);
+        std::lock_guard lock(shard.mutex);
+
+        if (!shard.table.Insert(hash, key, value, *this)) {
+            return false;
+        }
+        size_.fetch_add(1);
+        return true;
+    }
+
+    bool Erase(const K& key) {
+        auto hash = HashOf(key);
+        auto& shard = GetShard(hash);
+        std::lock_guard lock(shard.mutex);
+
+        if (!shard.table.Erase(hash, key)) {
+            return false;
+        }
+        size_.fetch_sub(1);
+        return true;
+    }
+
+    void Clear() {
+        for (size_t i = 0; i < shards_count_; ++i) {
+            shards_[i].mutex.lock();
+        }
+
+        size_.store(0);
+        for (size_t i = 0; i < shards_count_; ++i) {
+            shards_[i].table = Table();
+        }
+
+        for (size_t i = shards_count_; i > 0; --i) {
+            shards_[i - 1].mutex.unlock();
+        }
+    }
+
+    std::pair<bool, V> Find(const K& key) const {
+        auto hash = HashOf(key);
+        auto& shard = GetShard(hash);
+        std::lock_guard lock(shard.mutex);
+
+        if (auto slot = shard.table.Find(hash, key)) {
+            return {true, slot->second};
+        }
+        return {false, V()};
+    }
+
+    const V At(const K& key) const {
+        auto [has, value] = Find(key);
+
+        if (!has) {
+            throw std::out_of_range{"no such key"};
+        }
+        return value;
+    }
+
+    size_t Size() const {
+        return size_.load();
+    }
+
+private:
+    using Entry = std::pair<K, V>;
+
+    // Control bytes: the 7 low bits of the hash for full slots, special values otherwise.
+    inline static constexpr int8_t kEmpty = -128;
+    inline static constexpr int8_t kDeleted = -2;
+    inline static constexpr size_t kGroupSize = 16;
+
+    // Bit i is set if the i-th control byte of the group equals the value.
+    static uint32_t MatchGroup(const int8_t* group, int8_t value) {
+#ifdef __SSE2__
+        auto ctrl = _mm_load_si128(reinterpret_cast<const __m128i*>(group));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(value)));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kGroupSize; ++i) {
+            mask |= static_cast<uint32_t>(group[i] == value) << i;
+        }
+        return mask;
+#endif
+    }
+
+    // Bit i is set if the i-th slot of the group is empty or deleted.
+    static uint32_t MatchFree(const int8_t* group) {
+#ifdef __SSE2__
+        auto ctrl = _mm_load_si128(reinterpret_cast<const __m128i*>(group));
+        return _mm_movemask_epi8(_mm_cmplt_epi8(ctrl, _mm_set1_epi8(-1)));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kGroupSize; ++i) {
+            mask |= static_cast<uint32_t>(group[i] < -1) << i;
+        }
+        return mask;
+#endif
+    }
+
+    // Open-addressing table. Probing visits whole aligned groups in triangular order and stops
+    // at the first group with an empty slot.
+    class Table {
+    public:
+        Table() = default;
+
+        Table(Table&& other) noexcept {
+            Swap(other);
+        }
+        Table& operator=(Table&& other) noexcept {
+            Table tmp(std::move(other));
+            Swap(tmp);
+            return *this;
+        }
+
+        ~Table() {
+            for (size_t i = 0; i < capacity_; ++i) {
+                if (ctrl_[i] >= 0) {
+                    std::destroy_at(SlotAt(i));
+                }
+            }
+            ::operator delete[](ctrl_, std::align_val_t{kGroupSize});
+            ::operator delete[](slots_, std::align_val_t{alignof(Entry)});
+        }
+
+        void Reserve(size_t count, const FlatConcurrentHashMap& map) {
+            size_t capacity = std::bit_ceil(std::max(kGroupSize, count * 8 / 7 + 1));
+            if (capacity > capacity_) {
+                Resize(capacity, map);
+            }
+        }
+
+        const Entry* Find(uint64_t hash, const K& key) const {
+            if (!capacity_) {
+                return nullptr;
+            }
+
+            auto tag = Tag(hash);
+            size_t group = GroupIndex(hash);
+            for (size_t step = 1;; ++step) {
+                const int8_t* ctrl = ctrl_ + group * kGroupSize;
+                for (uint32_t mask = MatchGroup(ctrl, tag); mask; mask &= mask - 1) {
+                    size_t idx = group * kGroupSize + std::countr_zero(mask);
+                    if (SlotAt(idx)->first == key) {
+                        return SlotAt(idx);
+                    }
+                }
+                if (MatchGroup(ctrl, kEmpty)) {
+                    return nullptr;
+                }
+                group = (group + step) & GroupMask();
+            }
+        }
+
+        bool Insert(uint64_t hash, const K& key, const V& value,
+                    const FlatConcurrentHashMap& map) {
+            if (Find(hash, key)) {
+                return false;
+            }
+            if ((size_ + deleted_ + 1) * 8 > capacity_ * 7) {
+                // Mostly tombstones: rebuild with the same capacity instead of growing.
+                Resize(size_ * 2 < capacity_ ? capacity_ : std::max(kGroupSize, capacity_ * 2),
+                       map);
+            }
+
+            size_t idx = FindFree(hash);
+            deleted_ -= ctrl_[idx] == kDeleted;
+            ctrl_[idx] = Tag(hash);
+            std::construct_at(SlotAt(idx), key, value);
+            size_ += 1;
+            return true;
+        }
+
+        bool Erase(uint64_t hash, const K& key) {
+            auto slot = Find(hash, key);
+            if (!slot) {
+                return false;
+            }
+
+            size_t idx = slot - SlotAt(0);
+            std::destroy_at(SlotAt(idx));
+            // Probes stop at a group with an empty slot, so none of them went through this one.
+            if (MatchGroup(ctrl_ + idx / kGroupSize * kGroupSize, kEmpty)) {
+                ctrl_[idx] = kEmpty;
+            } else {
+                ctrl_[idx] = kDeleted;
+                deleted_ += 1;
+            }
+            size_ -= 1;
+            return true;
+        }
+
+    private:
+        static int8_t Tag(uint64_t hash) {
+            return static_cast<int8_t>(hash & 0x7f);
+        }
+
+        size_t GroupIndex(uint64_t hash) const {
+            return (hash >> 7) & GroupMask();
+        }
+
+        size_t GroupMask() const {
+            return capacity_ / kGroupSize - 1;
+        }
+
+        Entry* SlotAt(size_t idx) const {
+            return std::launder(reinterpret_cast<Entry*>(slots_) + idx);
+        }
+
+        size_t FindFree(uint64_t hash) const {
+            size_t group = GroupIndex(hash);
+            for (size_t step = 1;; ++step) {
+                if (auto mask = MatchFree(ctrl_ + group * kGroupSize)) {
+                    return group * kGroupSize + std::countr_zero(mask);
+                }
+                group = (group + step) & GroupMask();
+            }
+        }
+
+        void Resize(size_t capacity, const FlatConcurrentHashMap& map) {
+            Table other;
+            other.ctrl_ = static_cast<int8_t*>(
+                ::operator new[](capacity, std::align_val_t{kGroupSize}));
+            std::memset(other.ctrl_, kEmpty, capacity);
+            other.slots_ = static_cast<Entry*>(
+                ::operator new[](capacity * sizeof(Entry), std::align_val_t{alignof(Entry)}));
+            // Only now: ~Table walks capacity_ control bytes.
+            other.capacity_ = capacity;
+
+            for (size_t i = 0; i < capacity_; ++i) {
+                if (ctrl_[i] < 0) {
+                    continue;
+                }
+                uint64_t hash = map.HashOf(SlotAt(i)->first);
+                size_t idx = other.FindFree(hash);
+                other.ctrl_[idx] = Tag(hash);
+                std::construct_at(other.SlotAt(idx), std::move(*SlotAt(i)));
+                other.size_ += 1;
+            }
+
+            Swap(other);
+        }
+
+        void Swap(Table& other) {
+            std::swap(ctrl_, other.ctrl_);
+            std::swap(slots_, other.slots_);
+            std::swap(capacity_, other.capacity_);
+            std::swap(size_, other.size_);
+            std::swap(deleted_, other.deleted_);
+        }
+
+        int8_t* ctrl_ = nullptr;
+        Entry* slots_ = nullptr;
+        size_t capacity_ = 0;
+        size_t size_ = 0;
+        size_t deleted_ = 0;
+    };
+
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        Table table;
+    };
+
+    static uint64_t Mix(uint64_t hash) {
+        // std::hash of integers is the identity, spread the bits before using them.
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    uint64_t HashOf(const K& key) const {
+        return Mix(hasher_(key));
+    }
+
+    Shard& GetShard(uint64_t hash) const {
+        return shards_[shard_shift_ == 64 ? 0 : hash >> shard_shift_];
+    }
+
+    Hash hasher_;
+    std::unique_ptr<Shard[]> shards_;
+    size_t shards_count_ = 0;
+    int shard_shift_ = 64;
+    std::atomic<size_t> size_{};
+};
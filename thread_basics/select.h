@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../lock_free/futex.h"
+
+// Go-style select over BufferedChannel and UnbufferedChannel:
+//
+//    Select(OnRecv(requests, [](std::optional<Request> request) { ... }),
+//           OnSend(replies, reply, [] { ... }),
+//           OnDefault([] { ... }));
+//
+// Runs exactly one ready case and returns its index. A receive case on a closed and drained
+// channel is ready and gets std::nullopt, a send case on a closed channel throws. Without a
+// default case Select blocks: it registers on every channel and sleeps until one of them
+// changes, then tries the cases again.
+//
+// A send case on an UnbufferedChannel is ready only while a receiver is blocked in Recv.
+
+// A thread sleeping in Select.
+class SelectWaiter {
+public:
+    void Notify() {
+        if (notified_.exchange(1) == 0) {
+            FutexWake(&notified_, 1);
+        }
+    }
+
+    void Wait() {
+        while (notified_.load() == 0) {
+            FutexWait(&notified_, 0);
+        }
+        notified_.store(0);
+    }
+
+private:
+    std::atomic<int> notified_{};
+};
+
+// Select waiters registered on a channel. The channel calls NotifyAll after every change that
+// may make a case ready.
+class SelectWaiters {
+public:
+    void Add(SelectWaiter* waiter) {
+        std::lock_guard lock(mutex_);
+        waiters_.push_back(waiter);
+        count_.fetch_add(1);
+    }
+
+    void Remove(SelectWaiter* waiter) {
+        std::lock_guard lock(mutex_);
+        if (auto it = std::find(waiters_.begin(), waiters_.end(), waiter); it != waiters_.end()) {
+            waiters_.erase(it);
+            count_.fetch_sub(1);
+        }
+    }
+
+    void NotifyAll() {
+        // Pairs with the fence in Select: either it sees the change or we see the waiter.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        NotifyAllFenced();
+    }
+
+    void NotifyAllFenced() {
+        if (count_.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        std::lock_guard lock(mutex_);
+        for (auto waiter : waiters_) {
+            waiter->Notify();
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<SelectWaiter*> waiters_;
+    std::atomic<int> count_{};
+};
+
+template <class Channel, class F>
+struct RecvCase {
+    Channel* channel;
+    F fn;
+
+    bool TryRun() {
+        if (auto value = channel->TryRecv()) {
+            fn(std::move(value));
+            return true;
+        }
+        if (channel->IsClosed()) {
+            // Values sent before Close are still delivered.
+            fn(channel->TryRecv());
+            return true;
+        }
+        return false;
+    }
+};
+
+template <class Channel, class T, class F>
+struct SendCase {
+    Channel* channel;
+    T value;
+    F fn;
+
+    bool TryRun() {
+        if (!channel->TrySend(std::move(value))) {
+            return false;
+        }
+        fn();
+        return true;
+    }
+};
+
+template <class F>
+struct DefaultCase {
+    F fn;
+};
+
+// fn(std::optional<T>) is called with the received value, or std::nullopt if the channel is
+// closed.
+template <class Channel, class F>
+RecvCase<Channel, F> OnRecv(Channel& channel, F fn) {
+    return {&channel, std::move(fn)};
+}
+
+template <class Channel, class T, class F>
+SendCase<Channel, std::decay_t<T>, F> OnSend(Channel& channel, T&& value, F fn) {
+    return {&channel, std::forward<T>(value), std::move(fn)};
+}
+
+template <class F>
+DefaultCase<F> OnDefault(F fn) {
+    return {std::move(fn)};
+}
+
+template <class T>
+struct IsDefaultCase : std::false_type {};
+
+template <class F>
+struct IsDefaultCase<DefaultCase<F>> : std::true_type {};
+
+template <class Case>
+bool TryCase(Case& c) {
+    if constexpr (IsDefaultCase<Case>::value) {
+        return false;
+    } else {
+        return c.TryRun();
+    }
+}
+
+template <class Case>
+void Register(Case& c, SelectWaiter* waiter) {
+    if constexpr (!IsDefaultCase<Case>::value) {
+        c.channel->Waiters().Add(waiter);
+    }
+}
+
+template <class Case>
+void Unregister(Case& c, SelectWaiter* waiter) {
+    if constexpr (!IsDefaultCase<Case>::value) {
+        c.channel->Waiters().Remove(waiter);
+    }
+}
+
+template <size_t... I, class... Cases>
+size_t SelectImpl(std::index_sequence<I...>, Cases&... cases) {
+    constexpr size_t kCount = sizeof...(Cases);
+    constexpr size_t kDefault = std::min({(IsDefaultCase<Cases>::value ? I : kCount)...});
+    static_assert(kCount > 0);
+    static_assert((IsDefaultCase<Cases>::value + ...) <= 1, "more than one default case");
+
+    // Starts from a different case every time, so none of them starves.
+    thread_local size_t start = 0;
+    auto try_cases = [&]() -> std::optional<size_t> {
+        auto first = start++;
+        for (size_t step = 0; step < kCount; ++step) {
+            size_t index = (first + step) % kCount;
+            bool fired = false;
+            ((index == I && (fired = TryCase(cases))), ...);
+            if (fired) {
+                return index;
+            }
+        }
+        return std::nullopt;
+    };
+
+    if (auto index = try_cases()) {
+        return *index;
+    }
+    if constexpr (kDefault < kCount) {
+        std::get<kDefault>(std::tie(cases...)).fn();
+        return kDefault;
+    } else {
+        SelectWaiter waiter;
+        auto unregister = [&] { (Unregister(cases, &waiter), ...); };
+        // Unregisters even if a send case throws.
+        struct Guard {
+            decltype(unregister)& fn;
+            ~Guard() {
+                fn();
+            }
+        } guard{unregister};
+        (Register(cases, &waiter), ...);
+
+        while (true) {
+            // Pairs with the fence in SelectWaiters::NotifyAll.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (auto index = try_cases()) {
+                return *index;
+            }
+            waiter.Wait();
+        }
+    }
+}
+
+template <class... Cases>
+size_t Select(Cases&&... cases) {
+    return SelectImpl(std::index_sequence_for<Cases...>(), cases...);
+}
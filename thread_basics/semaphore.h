@@ -1,10 +1,16 @@
 #pragma once
 
-#include <mutex>
-#include <condition_variable>
-#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <concepts>
 #include <deque>
-#include <map>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+
+#include "../lock_free/futex.h"
 
 class DefaultCallback {
 public:
@@ -13,42 +19,226 @@ public:
     }
 };
 
+// Counting semaphore with weighted permits. Enter and Leave are a single atomic operation on
+// one word while nobody waits; threads that have to wait sleep on a futex.
+//
+// The word holds count * 2, bit 0 is set while there are waiters, so the count is at most
+// kMaxCount: the constructor and Leave throw instead of going past it. Enter and Leave take
+// 1..kMaxCount permits and throw std::invalid_argument otherwise. A FIFO semaphore queues the
+// waiters and hands released permits to them in order, so a waiter for many permits holds up
+// the ones behind it. Otherwise every Leave wakes all waiters and they race for the permits.
 class Semaphore {
 public:
-    Semaphore(int count) : count_(count) {
+    using Clock = std::chrono::steady_clock;
+
+    inline static constexpr int kMaxCount = std::numeric_limits<int>::max() / 2;
+
+    Semaphore(int count, bool fifo = true) : fifo_(fifo) {
+        if (count < 0 || count > kMaxCount) {
+            throw std::invalid_argument("semaphore count is out of range");
+        }
+        word_.store(count * 2, std::memory_order_relaxed);
     }
 
-    void Leave() {
-        std::unique_lock lock(mutex_);
-        ++count_;
-        cv_.notify_one();
+    Semaphore(const Semaphore&) = delete;
+    Semaphore& operator=(const Semaphore&) = delete;
+
+    void Leave(int n = 1) {
+        if (n <= 0) {
+            throw std::invalid_argument("semaphore permits count should be positive");
+        }
+        auto state = word_.load(std::memory_order_relaxed);
+        do {
+            if (n > kMaxCount - (state >> 1)) {
+                throw std::overflow_error("semaphore count overflow");
+            }
+        } while (!word_.compare_exchange_weak(state, state + n * 2, std::memory_order_release,
+                                              std::memory_order_relaxed));
+        if (!(state & 1)) {
+            return;
+        }
+        if (fifo_) {
+            std::lock_guard lock(mutex_);
+            Dispatch();
+        } else if (word_.fetch_and(~1) & 1) {
+            FutexWake(&word_, -1);
+        }
     }
 
-    template <class Func>
+    // Takes n permits. Blocks forever if n exceeds what will ever be available.
+    void Enter(int n = 1) {
+        EnterUntil(n, std::nullopt);
+    }
+
+    // Waits for a permit like Enter(), then calls callback with the count as if the permit had
+    // not been taken yet, and sets the count to whatever the callback leaves there. Callbacks
+    // run one at a time; a negative value counts as 0.
+    template <std::invocable<int&> Func>
     void Enter(Func callback) {
-        std::unique_lock lock(mutex_);
+        Enter();
+        RunCallback(callback);
+    }
+
+    // Takes n permits if they are available and no one is queued for them.
+    bool TryEnter(int n = 1) {
+        CheckPermits(n);
+        return TryAcquire(n);
+    }
+
+    // Enter that gives up after the timeout. Returns false if it did not enter; the thread
+    // leaves the queue then, so the ones behind it are not held up.
+    template <class Rep, class Period, std::invocable<int&> Func>
+    bool TryEnterFor(const std::chrono::duration<Rep, Period>& timeout, Func callback) {
+        return TryEnterUntil(Clock::now() + std::chrono::ceil<Clock::duration>(timeout),
+                             callback);
+    }
+
+    template <class Rep, class Period>
+    bool TryEnterFor(const std::chrono::duration<Rep, Period>& timeout) {
+        return TryEnterFor(1, timeout);
+    }
+
+    template <class Rep, class Period>
+    bool TryEnterFor(int n, const std::chrono::duration<Rep, Period>& timeout) {
+        return TryEnterUntil(n, Clock::now() + std::chrono::ceil<Clock::duration>(timeout));
+    }
+
+    template <std::invocable<int&> Func>
+    bool TryEnterUntil(Clock::time_point deadline, Func callback) {
+        if (!TryEnterUntil(1, deadline)) {
+            return false;
+        }
+        RunCallback(callback);
+        return true;
+    }
+
+    bool TryEnterUntil(int n, Clock::time_point deadline) {
+        return EnterUntil(n, deadline);
+    }
+
+private:
+    struct Waiter {
+        int n;
+        std::atomic<int> granted{};
+    };
+
+    static void CheckPermits(int n) {
+        if (n <= 0 || n > kMaxCount) {
+            throw std::invalid_argument("semaphore permits count is out of range");
+        }
+    }
 
-        if (count_ == 0) {
-            size_t id = max_id_++;
-            threads_.push_back(id);
-            while (count_ == 0 && threads_.front() != id) {
-                cv_.wait(lock);
+    bool TryAcquire(int n) {
+        auto state = word_.load(std::memory_order_relaxed);
+        // Newcomers queue up behind the waiting threads even if there are enough permits.
+        while ((!fifo_ || !(state & 1)) && (state >> 1) >= n) {
+            if (word_.compare_exchange_weak(state, state - n * 2, std::memory_order_acquire,
+                                            std::memory_order_relaxed)) {
+                return true;
             }
-            threads_.pop_front();
         }
+        return false;
+    }
 
-        callback(count_);
+    bool EnterUntil(int n, std::optional<Clock::time_point> deadline) {
+        CheckPermits(n);
+        if (TryAcquire(n)) {
+            return true;
+        }
+        return fifo_ ? EnterQueued(n, deadline) : EnterAny(n, deadline);
     }
 
-    void Enter() {
-        DefaultCallback callback;
-        Enter(callback);
+    bool EnterAny(int n, std::optional<Clock::time_point> deadline) {
+        while (!TryAcquire(n)) {
+            auto state = word_.load();
+            if ((state >> 1) >= n) {
+                continue;
+            }
+            // A Leave in between changes the word, then the CAS or the futex wait fails.
+            if (!(state & 1) && !word_.compare_exchange_weak(state, state | 1)) {
+                continue;
+            }
+            if (!deadline) {
+                FutexWait(&word_, state | 1);
+            } else if (!FutexWaitUntil(&word_, state | 1, *deadline)) {
+                return TryAcquire(n);
+            }
+        }
+        return true;
     }
 
-private:
+    bool EnterQueued(int n, std::optional<Clock::time_point> deadline) {
+        Waiter waiter{n};
+        {
+            std::lock_guard lock(mutex_);
+            word_.fetch_or(1);
+            waiter_queue_.push_back(&waiter);
+            Dispatch();
+        }
+
+        while (waiter.granted.load(std::memory_order_acquire) == 0) {
+            if (!deadline) {
+                FutexWait(&waiter.granted, 0);
+            } else if (!FutexWaitUntil(&waiter.granted, 0, *deadline)) {
+                std::lock_guard lock(mutex_);
+                if (waiter.granted.load()) {
+                    return true;
+                }
+                waiter_queue_.erase(
+                    std::find(waiter_queue_.begin(), waiter_queue_.end(), &waiter));
+                // We may have held up the ones behind us.
+                Dispatch();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Hands permits to the queued waiters in order. Called under mutex_.
+    void Dispatch() {
+        auto state = word_.load();
+        while (!waiter_queue_.empty()) {
+            auto waiter = waiter_queue_.front();
+            if ((state >> 1) < waiter->n) {
+                return;
+            }
+            if (!word_.compare_exchange_weak(state, state - waiter->n * 2)) {
+                continue;
+            }
+            waiter_queue_.pop_front();
+            waiter->granted.store(1, std::memory_order_release);
+            FutexWake(&waiter->granted, 1);
+        }
+        word_.fetch_and(~1);
+    }
+
+    template <class Func>
+    void RunCallback(Func& callback) {
+        std::lock_guard lock(callback_mutex_);
+        int count = word_.load() >> 1;
+        int value = count + 1;
+        callback(value);
+        value = std::max(value, 0);
+        if (value > count) {
+            Leave(value - count);
+        } else if (value < count) {
+            Drain(count - value);
+        }
+    }
+
+    // Takes up to n permits without waiting: others may have entered since the callback saw
+    // the count.
+    void Drain(int n) {
+        auto state = word_.load(std::memory_order_relaxed);
+        while (!word_.compare_exchange_weak(state, state - std::min(n, state >> 1) * 2,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed)) {
+        }
+    }
+
+    std::atomic<int> word_;
+    const bool fifo_;
     std::mutex mutex_;
-    std::condition_variable cv_;
-    int count_ = 0;
-    size_t max_id_ = 0;
-    std::deque<size_t> threads_{};
+    std::deque<Waiter*> waiter_queue_;
+    std::mutex callback_mutex_;
 };
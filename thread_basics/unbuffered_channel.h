@@ -1,79 +1,287 @@
 #pragma once
 
 #include <atomic>
-#include <utility>
+#include <chrono>
 #include <optional>
-#include <deque>
-#include <condition_variable>
-#include <mutex>
 #include <stdexcept>
-#include <memory>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "../lock_free/epoch.h"
+#include "../lock_free/futex.h"
+#include "select.h"
 
+// Synchronous channel on a lock-free dual stack of waiters.
+//
+// The stack holds either waiting senders or waiting receivers. A thread that finds a waiter of
+// the opposite kind on top pops it with one CAS and completes the handoff through the waiter's
+// node, otherwise it pushes its own node and waits on it: a few spins, then a futex. Nobody
+// holds a lock, so many pairs can be in the middle of a handoff at once.
+//
+// A node is referenced by its owner and by the stack. Whoever drops the last reference retires
+// it through EBR, since other threads may still be looking at it.
 template <class T>
 class UnbufferedChannel {
 public:
+    using Clock = std::chrono::steady_clock;
+
     UnbufferedChannel() = default;
 
-    void Send(const T& value) {
-        std::unique_lock lock_send(mtx_send_);
+    UnbufferedChannel(const UnbufferedChannel&) = delete;
+    UnbufferedChannel& operator=(const UnbufferedChannel&) = delete;
 
-        if (closed_.load()) {
-            throw std::runtime_error("chan in closed");
+    ~UnbufferedChannel() {
+        // Only cancelled nodes can be left, their owners are gone.
+        auto node = head_.load();
+        while (node && node != kClosed) {
+            delete std::exchange(node, node->next);
         }
+    }
 
-        std::unique_lock lock(mtx_);
-        state_.store(1);
-        value_ = std::move(value);
-
-        recv_.notify_one();
-        send_.wait(lock, [this] {
-            if (closed_.load() && state_.load() != 2) {
-                throw std::runtime_error("chan in closed");
-            }
+    void Send(const T& value) {
+        Transfer(&value, std::nullopt, false);
+    }
 
-            return state_.load() == 2;
-        });
+    // Send that gives up if no receiver took the value before the timeout. Returns false in
+    // that case.
+    template <class Rep, class Period>
+    bool SendFor(const T& value, const std::chrono::duration<Rep, Period>& timeout) {
+        return SendUntil(value, Clock::now() + std::chrono::ceil<Clock::duration>(timeout));
     }
 
-    std::optional<T> Recv() {
-        std::unique_lock lock_recv(mtx_recv_);
+    bool SendUntil(const T& value, Clock::time_point deadline) {
+        return Transfer(&value, deadline, false);
+    }
 
-        if (closed_.load()) {
-            return std::nullopt;
-        }
+    // Succeeds only if a receiver is waiting, otherwise returns false right away.
+    bool TrySend(const T& value) {
+        return Transfer(&value, std::nullopt, true);
+    }
 
-        std::unique_lock lock(mtx_);
+    std::optional<T> Recv() {
         std::optional<T> ret;
-        recv.wait(lock, [this, &ret] {
-            if (closed_.load()) {
-                return true;
-            }
+        Transfer(&ret, std::nullopt, false);
+        return ret;
+    }
 
-            char tmp = 1;
-            if (state_.compare_exchange_weak(tmp, 2)) {
-                ret.emplace(std::move(value_));
-                send_.notify_one();
-            }
+    // Recv that gives up after the timeout. Returns std::nullopt on timeout, as well as after
+    // Close, use IsClosed to tell them apart.
+    template <class Rep, class Period>
+    std::optional<T> RecvFor(const std::chrono::duration<Rep, Period>& timeout) {
+        return RecvUntil(Clock::now() + std::chrono::ceil<Clock::duration>(timeout));
+    }
 
-            return tmp == 1;
-        });
+    std::optional<T> RecvUntil(Clock::time_point deadline) {
+        std::optional<T> ret;
+        Transfer(&ret, deadline, false);
+        return ret;
+    }
 
+    // Takes the value of a waiting sender, otherwise returns std::nullopt right away.
+    std::optional<T> TryRecv() {
+        std::optional<T> ret;
+        Transfer(&ret, std::nullopt, true);
         return ret;
     }
 
+    // Waiting senders throw, waiting receivers get std::nullopt.
     void Close() {
         closed_.store(true);
-        send_.notify_all();
-        recv_.notify_all();
+        {
+            EpochGuard guard;
+            auto node = head_.exchange(kClosed);
+            while (node && node != kClosed) {
+                auto next = node->next;
+                auto state = node->state.load();
+                while ((state == kWaiting || state == kParked) &&
+                       !node->state.compare_exchange_weak(state, kClosedState)) {
+                }
+                if (state == kParked) {
+                    FutexWake(&node->state, 1);
+                }
+                Release(node);
+                node = next;
+            }
+        }
+        select_waiters_.NotifyAll();
+    }
+
+    bool IsClosed() const {
+        return closed_.load();
+    }
+
+    // Used by Select.
+    SelectWaiters& Waiters() {
+        return select_waiters_;
     }
 
 private:
-    T value_;
-    std::mutex mtx_;
-    std::mutex mtx_send_;
-    std::mutex mtx_recv_;
-    std::atomic_char state_{};  // 0 -- empty, 1 -- sended, 2 -- received
+    enum State : int {
+        kWaiting,
+        kParked,  // the owner sleeps on the futex
+        kBusy,    // the other side is moving the value
+        kDone,
+        kCancelled,  // the owner gave up
+        kClosedState,
+    };
+
+    struct Node {
+        std::atomic<int> state{kWaiting};
+        std::atomic<int> refs{2};
+        bool is_data = false;
+        Node* next = nullptr;  // immutable once pushed
+        std::optional<T> value;
+    };
+
+    inline static Node* const kClosed = reinterpret_cast<Node*>(alignof(Node));
+    inline static constexpr int kSpins = 128;
+
+    static void Release(Node* node) {
+        if (node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            EpochManager::Instance().Retire(node);
+        }
+    }
+
+    // Sends *arg if it is a const T*, receives into it if it is a std::optional<T>*. Returns
+    // false if it timed out or, with try_only, if nobody was waiting.
+    template <class Arg>
+    bool Transfer(Arg* arg, std::optional<Clock::time_point> deadline, bool try_only) {
+        constexpr bool kIsData = std::is_same_v<Arg, const T>;
+        Node* node = nullptr;
+        {
+            EpochGuard guard;
+            while (true) {
+                auto head = head_.load(std::memory_order_acquire);
+                if (head == kClosed) {
+                    delete node;
+                    return Closed<kIsData>();
+                }
+
+                if (head && head->state.load() == kCancelled) {
+                    if (head_.compare_exchange_weak(head, head->next)) {
+                        Release(head);
+                    }
+                    continue;
+                }
+
+                if (head && head->is_data != kIsData) {
+                    // Whoever pops a waiter owns the handoff.
+                    if (head_.compare_exchange_weak(head, head->next)) {
+                        bool matched = Fulfill(head, arg);
+                        Release(head);
+                        if (matched) {
+                            delete node;
+                            return true;
+                        }
+                    }
+                    continue;
+                }
+
+                if (try_only) {
+                    delete node;
+                    return false;
+                }
+                if (!node) {
+                    node = new Node();
+                    node->is_data = kIsData;
+                    if constexpr (kIsData) {
+                        node->value.emplace(*arg);
+                    }
+                }
+                node->next = head;
+                if (head_.compare_exchange_weak(head, node, std::memory_order_release,
+                                                std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+        }
+        // Select cases of the other kind may be ready now.
+        select_waiters_.NotifyAll();
+
+        auto state = Await(node, deadline);
+        if constexpr (!kIsData) {
+            if (state == kDone) {
+                *arg = std::move(node->value);
+            }
+        }
+        Release(node);
+
+        if (state == kClosedState) {
+            return Closed<kIsData>();
+        }
+        return state == kDone;
+    }
+
+    template <bool kIsData>
+    static bool Closed() {
+        if constexpr (kIsData) {
+            throw std::runtime_error("chan in closed");
+        }
+        return false;
+    }
+
+    // Completes the handoff with a popped waiter. Returns false if the waiter has given up.
+    template <class Arg>
+    static bool Fulfill(Node* node, Arg* arg) {
+        auto state = node->state.load();
+        do {
+            if (state != kWaiting && state != kParked) {
+                return false;
+            }
+        } while (!node->state.compare_exchange_weak(state, kBusy));
+
+        if constexpr (std::is_same_v<Arg, const T>) {
+            node->value.emplace(*arg);
+        } else {
+            *arg = std::move(node->value);
+        }
+        node->state.store(kDone, std::memory_order_release);
+        if (state == kParked) {
+            FutexWake(&node->state, 1);
+        }
+        return true;
+    }
+
+    // Waits until the node is done or closed, or cancels it at the deadline.
+    static int Await(Node* node, std::optional<Clock::time_point> deadline) {
+        static const int spins = std::thread::hardware_concurrency() > 1 ? kSpins : 0;
+        for (int i = 0; i < spins && node->state.load(std::memory_order_relaxed) == kWaiting;
+             ++i) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+
+        while (true) {
+            auto state = node->state.load(std::memory_order_acquire);
+            if (state == kDone || state == kClosedState) {
+                return state;
+            }
+            if (state == kBusy) {
+                std::this_thread::yield();
+                continue;
+            }
+            if (state == kWaiting) {
+                node->state.compare_exchange_weak(state, kParked);
+                continue;
+            }
+
+            if (!deadline) {
+                FutexWait(&node->state, kParked);
+                continue;
+            }
+            if (FutexWaitUntil(&node->state, kParked, *deadline)) {
+                continue;
+            }
+            // Timed out, unless the other side got to the node first.
+            if (node->state.compare_exchange_strong(state, kCancelled)) {
+                return kCancelled;
+            }
+        }
+    }
+
+    alignas(64) std::atomic<Node*> head_{};
     std::atomic_bool closed_{};
-    std::condition_variable send_;
-    std::condition_variable recv_;
+    SelectWaiters select_waiters_;
 };